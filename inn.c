@@ -9,6 +9,9 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -16,13 +19,35 @@
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define INN_VERSION "0.0.1"
 
 #define TAB_STOP 8
+#define ROW_GAP 16 // minimum gap opened in a row's chars when inserting
+#define HL_CHECKPOINT 256 // render columns between saved lexer states
+#define LONG_LINE (1 << 20) // chars, rows this long are rendered and highlighted a window at a time
+#define LONG_LINE_MARGIN 1024 // render columns a window is built past either side of what is shown
+#define LONG_LINE_CHECKPOINT (1 << 14) // render columns between lexer states saved along a long row
+#define HL_LOOKAHEAD 8 // rows below the screen highlighted ahead of scrolling
 #define QUIT_TIMES 3
+#ifndef UNDO_LIMIT
+#define UNDO_LIMIT (64 << 20) // bytes of undo history kept, the oldest is forgotten first
+#endif
+#define SAVE_IOV 1024 // iovecs gathered per writev when saving
+#define PASTE_CHUNK 4096 // bytes read at a time while a paste arrives
+#define INPUT_WAIT 100 // ms to wait for the rest of an escape sequence or paste
+#define PASTE_WAIT 10 // waits for input before giving up on a paste's end
+#define IDLE_TASKS 8 // the most idle tasks queued at once, each is queued once
+#define IDLE_ROWS 8192 // stale rows an idle slice of highlighting catches up
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 
@@ -36,7 +61,8 @@ enum editor_key {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    PASTE_START
 };
 
 enum editor_highlight {
@@ -53,7 +79,47 @@ enum editor_highlight {
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
 
+enum undo_type {
+    UNDO_INSERT_CHARS,
+    UNDO_DELETE_CHARS,
+    UNDO_INSERT_ROWS,
+    UNDO_DELETE_ROWS,
+    UNDO_REPLACE
+};
+
+enum prof_phase {
+    PROF_KEY, // handling a key, from reading it to the refresh after it
+    PROF_SYNTAX,
+    PROF_DRAW, // composing the frame and diffing it against the screen
+    PROF_WRITE,
+    PROF_PHASES
+};
+
+#define ROW_MAPPED (1<<0) // chars points into the file mapping and is not owned
+#define ROW_SLAB (1<<1) // the erow was allocated in bulk by editor_load
+#define ROW_LONG (1<<2) // render and hl only hold a window of the row, see row_window
+
 /* data */
+/* rows are kept in a b-tree whose nodes count the rows below them, so a
+** row's index is derived from its position and insert, delete and lookup
+** by index are all O(log n) */
+#define LT_ORDER 64
+
+struct lt_node {
+    struct lt_node* parent;
+    struct lt_node* prev; // neighbours on the same level
+    struct lt_node* next;
+    int leaf;
+    int n;
+    int count; // rows in this subtree
+    void* slot[LT_ORDER + 1]; // erow* in leaves, lt_node* otherwise. one spare slot to split from
+};
+
+struct row_iter {
+    struct lt_node* leaf;
+    int pos;
+};
+
 struct editor_syntax {
     char* filetype;
     char** filematch;
@@ -64,16 +130,286 @@ struct editor_syntax {
     int flags;
 };
 
+#define CC_SEPARATOR (1<<0)
+#define CC_DIGIT (1<<1)
+#define CC_QUOTE (1<<2)
+#define CC_KEYWORD (1<<3) // appears in some keyword
+#define CC_DELIM (1<<4) // starts a comment delimiter
+
+struct syntax_keyword {
+    const char* word;
+    int len;
+    int hl;
+};
+
+struct syntax_lexer {
+    struct editor_syntax* syntax;
+    unsigned char cclass[256];
+    struct syntax_keyword* kw; // keywords hashed without collisions into kwmask + 1 slots
+    unsigned int kwmask;
+    unsigned int kwseed;
+    int kw_maxlen;
+    const char* scs;
+    const char* mcs;
+    const char* mce;
+    int scs_len;
+    int mcs_len;
+    int mce_len;
+    int reach; // how far past a position the lexer may read
+};
+
+/* lexer state at a render column, saved every HL_CHECKPOINT columns so a
+** row can be re-highlighted from near the edit instead of from column 0.
+** along a long row they are sparser, and its windows are lexed from them */
+struct hl_state {
+    int pos;
+    int in_string;
+    int in_comment;
+    int line_comment;
+    int prev_sep;
+    int prev_hl; // of the column before pos
+};
+
+// a tab in a row, and the render column just past the spaces it expands to
+struct row_tab {
+    int cx;
+    int rx;
+};
+
+/* chars is a gap buffer: [0, gap) and [gap + gaplen, size + gaplen) hold
+** the text, so repeated inserts and deletes at the cursor are O(1) */
 typedef struct erow {
-    int idx;
+    struct lt_node* leaf;
+    int flags;
     int size;
+    int gap;
+    int gaplen;
+    int rstart; // render column render[0] holds, only a long row's window doesn't start at 0
     int rsize;
+    int rcap; // allocated size of render and hl
     char* chars;
-    char* render;
-    unsigned char* hl;
-    int hl_open_comment;
+    char* render; // NULL until the row is first drawn
+    unsigned char* hl; // NULL until the row is first highlighted, then rcap long
+    struct row_tab* tabs; // every tab in chars, kept with render so columns convert by binary search
+    int ntabs;
+    int tabcap;
+    int hl_gen; // hl was built from hl_start for this ES.hl_gen
+    int state_gen; // hl_start and hl_open_comment were lexed from the current chars for this ES.hl_gen
+    int hl_start; // comment state the row was lexed as starting in
+    int hl_open_comment; // and the one it ends in
+    struct hl_state* hlcp;
+    int nhlcp;
 } erow;
 
+#define ROW_CHAR(row, j) ((row)->chars[(j) < (row)->gap ? (j) : (j) + (row)->gaplen])
+
+#define ATTR_INVERSE 0x80 // or'ed into an editor_highlight
+
+struct screen {
+    int rows, cols;
+    char* chars; // the frame being composed
+    unsigned char* attrs;
+    char* shadow_chars; // what the terminal shows
+    unsigned char* shadow_attrs;
+    int valid; // shadow can be trusted
+    int cur_y, cur_x; // where the terminal cursor is, -1 when unknown
+    int cur_attr;
+    char sgr[256][12]; // escape sequence selecting each attribute
+    unsigned char sgrlen[256];
+};
+
+struct frame {
+    char* b; // arena, kept between frames
+    int len, cap;
+    int mark; // arena bytes before this are covered by an iovec
+    struct iovec* iov;
+    int niov;
+};
+
+struct undo_record {
+    int type;
+    int group; // records made by one command are undone together
+    int y, x;
+    int n; // rows held, for row and replace records
+    int cx, cy; // cursor before the command
+    int cx_after, cy_after;
+    size_t len; // bytes of text that follow the record
+};
+
+struct undo_journal {
+    char* arena; // records and their text, packed
+    size_t len, cap;
+    size_t* recs; // offsets of records in the arena
+    int nrecs, reccap;
+    int cur; // records before this are applied, the rest can be redone
+    int group;
+    int cx, cy; // cursor when the command began, what its records restore
+    int suspended; // edits aren't journaled while loading or undoing
+};
+
+struct swap_journal {
+    int fd; // -1 when edits aren't being journaled
+    char* name;
+    char* buf; // records not yet written
+    size_t len, cap;
+};
+
+struct regex_inst {
+    int op;
+    int x, y;
+};
+
+struct regex_dstate {
+    int* pcs; // the nfa instructions the state stands for
+    int npcs;
+    int unanchored; // a match may also start at the next byte
+    int accept, accept_eol;
+    int next[256]; // -1 until the transition is first taken
+};
+
+// a place in a row a match can start, as the sweep for match ends sees it
+struct regex_from {
+    int at;
+    int parent; // the start whose run this one's run joined, or -1
+    int joined; // the byte it joined at
+    int last; // where its run last accepted, or -1
+    int live; // its run is still going
+};
+
+struct regex {
+    struct regex_inst* prog;
+    int nprog;
+    unsigned char (*classes)[32]; // byte sets, one bit per byte
+    int nclasses;
+    char* prefix; // literal text every match starts with
+    int prefixlen;
+    struct regex_dstate* states;
+    int nstates;
+    int* table; // hash of instruction sets to states
+    int tablesize;
+    int start[2][2]; // [unanchored][at start of row]
+    int flushes;
+    int* mark; // closure scratch
+    int gen;
+    int* scratch;
+    int* kernel;
+    int reversed; // compiled from the pattern read right to left
+    struct regex* reverse; // the pattern backwards, run to find where matches start
+    char* starts; // set where a match in the row last marked can start
+    int startscap;
+    const char* startsrow;
+    int startsn;
+    struct regex_from* froms; // the sweep's starts, in row order
+    int nfroms, fromscap;
+    int* runs; // the dfa state of each live run, oldest first
+    int* roots; // and the start in froms it stands for
+    int nruns, runscap;
+    int* stamp; // per dfa state, stampgen when a live run is in it
+    int* runat; // and which
+    int stampgen;
+    int sweep; // the byte the sweep is at, or -1 when it gave up on the row
+    int sweepflushes; // flushes when the sweep last stepped, its runs' states are gone after another
+};
+
+struct find_match {
+    int y, x, len;
+};
+
+// matches in rows [lo, hi), or in job->rows[lo, hi) when narrowing
+struct find_chunk {
+    int lo, hi;
+    struct find_match* matches;
+    int n, cap;
+};
+
+struct find_job {
+    const char* q;
+    int len;
+    int regex; // q is a pattern
+    const int* rows; // the only rows that can match, or NULL to scan them all
+    const struct find_match* from; // when set, the only places matches can start
+    const int* first; // index in from of each row's first place, and one past the last
+    struct find_chunk* chunks;
+    int nchunks;
+    int next; // first chunk not yet claimed
+};
+
+struct find_result {
+    char* query;
+    int regex;
+    struct find_match* matches; // every match in the buffer in order, NULL once dropped from the cache
+    int nmatches;
+};
+
+
+struct find_state {
+    int regex;
+    struct regex* re;
+    char* pattern; // what re was compiled from
+    char prompt[80];
+    int active; // the find prompt is up
+    struct find_result* results; // a stack, each query is a prefix of the one above it
+    int nresults, capresults;
+    size_t cached; // bytes of matches the results hold
+    struct find_match* matches; // the top result's, which the prompt steps through
+    int nmatches;
+    int current; // the match the cursor is on, or -1
+    int origin_y, origin_x; // cursor when find started, the first match shown is at or after it
+};
+
+struct pool {
+    pthread_t* threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    int gen; // bumped for every job handed out
+    int busy; // workers still on the current job
+    void (*job)(void*);
+    void* arg;
+};
+
+/* a headless run that replays a script of keystrokes and times them, see
+** bench_main */
+struct bench {
+    int active;
+    int rows, cols; // the virtual screen
+    const char* script;
+    struct timespec key_read; // when the key being handled was read, tv_sec -1 between keys
+    long long* latency; // ns from reading each key to reading the next
+    int nkeys, capkeys;
+    long long* frame_bytes; // what each refresh would have written
+    int nframes, capframes;
+    int lines; // in the file as opened
+    double open_ms;
+};
+
+/* timings per frame, shown in the status bar while profiling. each probe
+** counts its own time less that of the probes that ran inside it, so
+** highlighting done while drawing is counted once, as highlighting */
+struct prof_probe {
+    long long start; // ns, 0 if profiling was off when it began
+    long long inner; // ES.prof.inner when it began
+};
+
+struct profile {
+    int active;
+    long long inner; // ns spent in probes that have ended
+    long long ns[PROF_PHASES]; // this frame's
+    int rows; // lexed again this frame
+    double avg_ms[PROF_PHASES]; // rolling averages over recent frames
+    double avg_bytes, avg_rows;
+    int frames; // averaged since profiling was turned on
+    struct prof_probe key; // the key being handled
+};
+
+/* the terminal and a self-pipe written by the SIGWINCH handler are waited
+** on in poll, with no timeout once the idle tasks are done, see events_idle */
+struct events {
+    int winch[2];
+    void (*idle[IDLE_TASKS])(void); // run in order while no input is pending
+    int nidle;
+};
+
 struct editor_config {
     int cx, cy;
     int rx;
@@ -82,13 +418,30 @@ struct editor_config {
     int screenrows;
     int screencols;
     int numrows;
-    erow* row;
+    struct lt_node* lines;
+    char* map; // read-only mapping of the opened file, rows point into it until edited
+    size_t maplen;
     int dirty;
+    struct syntax_lexer* lexer;
+    int hl_gen; // bumped to invalidate every row's hl at once
+    int hl_frontier; // rows above this start in the state they were lexed with
     char* filename;
     char statusmsg[80];
     time_t statusmsg_time;
     struct editor_syntax* syntax;
+    struct screen screen;
+    struct frame frame;
+    struct undo_journal undo;
+    struct swap_journal swap;
+    struct find_state find;
+    struct pool pool;
+    struct bench bench;
+    struct profile prof;
+    struct events events;
     struct termios orig_termios;
+    char* pending; // input read past the end of a paste, handed out before reading more
+    int npending;
+    int pendingpos;
 };
 struct editor_config ES;
 
@@ -124,10 +477,75 @@ struct editor_syntax HLDB[] = {
 
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
+struct syntax_lexer HLLEX[HLDB_ENTRIES]; // HLDB entries compiled on first use
+
 /* forward declarations */
 void editor_set_statusmessage(const char *fmt, ...);
 void refresh_screen();
-char* editor_prompt(char* prompt, void (*callback)(char*, int));
+char* row_chars(erow* row);
+erow* editor_render_row(erow* row);
+int editor_row_cxtorx(erow* row, int cx);
+int editor_row_rxtocx(erow* row, int rx);
+char* editor_prompt(char* prompt, void (*callback)(char*, int), int allow_empty);
+int writev_all(int fd, struct iovec* iov, int n);
+void swap_flush();
+void bench_key_done();
+void bench_key_read();
+void bench_frame(long long bytes);
+void bench_finish();
+void init_editor();
+void editor_resize();
+void syntax_idle();
+
+/* profile */
+#define PROF_SMOOTH 16 // frames the rolling averages are taken over
+
+// while profiling is off a probe costs a branch
+#define PROF_BEGIN(p) do { (p)->start = 0; if (ES.prof.active) prof_begin(p); } while (0)
+#define PROF_END(p, phase, rows) do { if ((p)->start) prof_end(p, phase, rows); } while (0)
+
+long long prof_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+void prof_begin(struct prof_probe* p) {
+    p->inner = ES.prof.inner;
+    p->start = prof_now();
+}
+
+void prof_end(struct prof_probe* p, int phase, int rows) {
+    long long ns = prof_now() - p->start;
+    ES.prof.ns[phase] += ns - (ES.prof.inner - p->inner);
+    ES.prof.inner = p->inner + ns;
+    ES.prof.rows += rows;
+    p->start = 0;
+}
+
+// fold the frame just written into the averages
+void prof_frame(long long bytes) {
+    struct profile* pr = &ES.prof;
+    if (!pr->active) return;
+    double w = (pr->frames < PROF_SMOOTH) ? 1.0 / (pr->frames + 1) : 1.0 / PROF_SMOOTH;
+    int j;
+    for (j = 0; j < PROF_PHASES; j++) {
+        pr->avg_ms[j] += (pr->ns[j] / 1e6 - pr->avg_ms[j]) * w;
+        pr->ns[j] = 0;
+    }
+    pr->avg_bytes += (bytes - pr->avg_bytes) * w;
+    pr->avg_rows += (pr->rows - pr->avg_rows) * w;
+    pr->rows = 0;
+    pr->frames++;
+}
+
+void prof_toggle() {
+    struct profile* pr = &ES.prof;
+    int active = !pr->active;
+    memset(pr, 0, sizeof(*pr));
+    pr->active = active;
+    editor_set_statusmessage("profiling %s", pr->active ? "on" : "off");
+}
 
 /* terminal */
 void clear_screen() {
@@ -142,6 +560,7 @@ void die(const char* s) {
 }
 
 void disable_raw_mode() {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8); // bracketed paste off
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &ES.orig_termios) == -1) { die("tcsetattr"); }
 }
 
@@ -154,37 +573,136 @@ void enable_raw_mode() {
     raw.c_oflag &= ~(OPOST); // disable output processing
     raw.c_cflag |= (CS8);
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG); // disable ECHO=echo, ICANON=canonical, IEXTEN=ctrl-v, ISIG=ctrl-z/ctrl-d/ctrl-c signals
-    raw.c_cc[VMIN] = 0; // minimum bytes needed for read() to return
-    raw.c_cc[VTIME] = 1; // read timeout after 100 milliseconds
+    raw.c_cc[VMIN] = 0; // read() returns at once with what there is, waiting is done in poll
+    raw.c_cc[VTIME] = 0;
 
     if (tcsetattr(STDERR_FILENO, TCSAFLUSH, &raw) == -1) { die("tcsetattr"); }
+    write(STDOUT_FILENO, "\x1b[?2004h", 8); // bracketed paste on, pastes arrive between ESC[200~ and ESC[201~
+}
+
+/* events */
+void events_winch(int sig) {
+    (void)sig;
+    int saved = errno;
+    write(ES.events.winch[1], "", 1); // if the pipe is full a resize is already due
+    errno = saved;
+}
+
+void events_init() {
+    if (pipe(ES.events.winch) == -1) die("pipe");
+    int j;
+    for (j = 0; j < 2; j++) {
+        fcntl(ES.events.winch[j], F_SETFL, O_NONBLOCK);
+        fcntl(ES.events.winch[j], F_SETFD, FD_CLOEXEC);
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = events_winch;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+}
+
+// wait up to ms (-1 for as long as it takes) for input, handling resizes on
+// the way. returns whether there is input
+int input_wait(int ms) {
+    struct pollfd fds[2] = {
+        { STDIN_FILENO, POLLIN, 0 },
+        { ES.events.winch[0], POLLIN, 0 }
+    };
+    while (1) {
+        int n = poll(fds, 2, ms);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) die("poll");
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (read(ES.events.winch[0], buf, sizeof(buf)) > 0);
+            editor_resize();
+            continue;
+        }
+        if (fds[0].revents & POLLIN) return 1;
+        if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) { // the terminal is gone, keep what was typed
+            swap_flush();
+            errno = EIO;
+            die("read");
+        }
+        return 0;
+    }
+}
+
+// queue task to run once the next time input goes idle
+void idle_schedule(void (*task)(void)) {
+    int j;
+    for (j = 0; j < ES.events.nidle; j++) {
+        if (ES.events.idle[j] == task) return;
+    }
+    ES.events.idle[ES.events.nidle++] = task;
+}
+
+/* run the idle tasks while no input is pending, then sleep until there is
+** some. a task does a slice of its work and queues itself again if there
+** is more, so input is checked for between slices */
+void events_idle() {
+    struct events* ev = &ES.events;
+    while (ev->nidle > 0 && !input_wait(0)) {
+        void (*task)(void) = ev->idle[0];
+        ev->nidle--;
+        memmove(&ev->idle[0], &ev->idle[1], sizeof(ev->idle[0]) * ev->nidle);
+        int prof = ES.prof.active; // idle work is part of no frame
+        ES.prof.active = 0;
+        task();
+        ES.prof.active = prof;
+    }
+    input_wait(-1);
+}
+
+// the next byte of input, waiting up to ms for one. returns 0 if none came
+int read_byte(char* c, int ms) {
+    if (ES.pendingpos < ES.npending) {
+        *c = ES.pending[ES.pendingpos++];
+        return 1;
+    }
+    if (ES.bench.active) return 0; // the script is all the input there is
+    if (ms && !input_wait(ms)) return 0;
+    return read(STDIN_FILENO, c, 1);
 }
 
 int read_key() {
     int nread;
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+    if (ES.bench.active) bench_key_done();
+    while ((nread = read_byte(&c, 0)) != 1) {
         if (nread == -1 && errno != EAGAIN) { die("read"); } // EAGAIN cygwin compatibility
+        if (ES.bench.active) bench_finish();
+        events_idle();
     }
+    if (ES.bench.active) bench_key_read();
+    PROF_BEGIN(&ES.prof.key);
 
     if (c == '\x1b') {
         char seq[3];
 
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        if (read_byte(&seq[0], INPUT_WAIT) != 1) return '\x1b';
+        if (read_byte(&seq[1], INPUT_WAIT) != 1) return '\x1b';
 
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                int n = seq[1] - '0';
+                while (1) {
+                    if (read_byte(&seq[2], INPUT_WAIT) != 1) return '\x1b';
+                    if (seq[2] < '0' || seq[2] > '9') break;
+                    n = n * 10 + seq[2] - '0';
+                }
                 if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
+                    switch (n) {
+                        case 1: return HOME_KEY;
+                        case 3: return DEL_KEY;
+                        case 4: return END_KEY;
+                        case 5: return PAGE_UP;
+                        case 6: return PAGE_DOWN;
+                        case 7: return HOME_KEY;
+                        case 8: return END_KEY;
+                        case 200: return PASTE_START;
                     }
                 }
             } else {
@@ -205,6 +723,77 @@ int read_key() {
     }
 }
 
+/* read a paste up to its ESC[201~ in chunks, with line endings made '\n'.
+** anything read past the end is kept for read_key */
+char* read_paste(int* len) {
+    const char* end_marker = "\x1b[201~";
+    int cap = PASTE_CHUNK;
+    char* buf = malloc(cap);
+    int n = 0;
+    int empty = 0;
+    char* end = NULL;
+
+    // whatever is left over from the last read comes first
+    if (ES.pendingpos < ES.npending) {
+        n = ES.npending - ES.pendingpos;
+        if (n > cap) {
+            cap = n * 2;
+            buf = realloc(buf, cap);
+        }
+        memcpy(buf, &ES.pending[ES.pendingpos], n);
+        ES.pendingpos = ES.npending = 0;
+        end = memmem(buf, n, end_marker, 6);
+    }
+
+    while (end == NULL && empty < PASTE_WAIT && !ES.bench.active) {
+        if (cap - n < PASTE_CHUNK) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+            if (buf == NULL) die("realloc");
+        }
+        if (!input_wait(INPUT_WAIT)) {
+            empty++;
+            continue;
+        }
+        int nread = read(STDIN_FILENO, &buf[n], PASTE_CHUNK);
+        if (nread == -1 && errno != EAGAIN) die("read");
+        if (nread <= 0) {
+            empty++;
+            continue;
+        }
+        empty = 0;
+        int from = (n > 5) ? n - 5 : 0; // the marker may straddle reads
+        n += nread;
+        end = memmem(&buf[from], n - from, end_marker, 6);
+    }
+
+    int size = n;
+    if (end) {
+        size = end - buf;
+        int rest = n - size - 6;
+        if (rest > 0) {
+            free(ES.pending);
+            ES.pending = malloc(rest);
+            memcpy(ES.pending, end + 6, rest);
+            ES.npending = rest;
+            ES.pendingpos = 0;
+        }
+    }
+
+    // terminals send enter as '\r'
+    int i, j = 0;
+    for (i = 0; i < size; i++) {
+        if (buf[i] == '\r') {
+            if (i + 1 < size && buf[i + 1] == '\n') continue;
+            buf[j++] = '\n';
+        } else {
+            buf[j++] = buf[i];
+        }
+    }
+    *len = j;
+    return buf;
+}
+
 int get_cursor_position(int *rows, int *cols) {
     char buf[32];
     unsigned int i = 0;
@@ -212,7 +801,7 @@ int get_cursor_position(int *rows, int *cols) {
     if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
 
     while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) { break; }
+        if (read_byte(&buf[i], INPUT_WAIT) != 1) { break; }
         if (buf[i] == 'R') { break; }
         i++;
     }
@@ -237,497 +826,3828 @@ int get_window_size(int* rows, int* cols) {
     }
 }
 
-/* syntax highlighting */
-int is_separator(int c) {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+/* line tree */
+struct lt_node* lt_node_new(int leaf) {
+    struct lt_node* node = calloc(1, sizeof(struct lt_node));
+    if (node == NULL) die("calloc");
+    node->leaf = leaf;
+    return node;
+}
+
+int lt_slot_of(struct lt_node* node, void* child) {
+    int i;
+    for (i = 0; i < node->n; i++) {
+        if (node->slot[i] == child) return i;
+    }
+    return -1;
+}
+
+int lt_weight(struct lt_node* node, int i) {
+    return node->leaf ? 1 : ((struct lt_node*)node->slot[i])->count;
+}
+
+// point the child in slot i back at node
+void lt_adopt(struct lt_node* node, int i) {
+    if (node->leaf) ((erow*)node->slot[i])->leaf = node;
+    else ((struct lt_node*)node->slot[i])->parent = node;
 }
 
-void update_syntax(erow* row) {
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
+void lt_node_insert(struct lt_node* node, int i, void* child) {
+    memmove(&node->slot[i + 1], &node->slot[i], sizeof(void*) * (node->n - i));
+    node->slot[i] = child;
+    node->n++;
+    lt_adopt(node, i);
+}
 
-    if (ES.syntax == NULL) return;
+void lt_node_remove(struct lt_node* node, int i) {
+    memmove(&node->slot[i], &node->slot[i + 1], sizeof(void*) * (node->n - i - 1));
+    node->n--;
+}
 
-    char** keywords = ES.syntax->keywords;
+void lt_unlink(struct lt_node* node) {
+    if (node->prev) node->prev->next = node->next;
+    if (node->next) node->next->prev = node->prev;
+}
 
-    char* scs = ES.syntax->singleline_comment_start;
-    char* mcs = ES.syntax->multiline_comment_start;
-    char* mce = ES.syntax->multiline_comment_end;
+void lt_insert_after(struct lt_node* node, struct lt_node* right);
 
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
+void lt_split(struct lt_node* node) {
+    struct lt_node* right = lt_node_new(node->leaf);
+    int half = node->n / 2;
+    int i;
 
-    int prev_sep = 1;
-    int in_string = 0;
-    int in_comment = (row->idx > 0 && ES.row[row->idx - 1].hl_open_comment);
+    right->n = node->n - half;
+    memcpy(right->slot, &node->slot[half], sizeof(void*) * right->n);
+    node->n = half;
+    for (i = 0; i < right->n; i++) {
+        lt_adopt(right, i);
+        right->count += lt_weight(right, i);
+    }
 
-    int i=0;
-    while (i < row->rsize) {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i-1] : HL_NORMAL;
+    struct lt_node* p;
+    for (p = node; p; p = p->parent) p->count -= right->count;
+    lt_insert_after(node, right);
+}
 
-        if (scs_len && !in_string && !in_comment) { // singleline comment
-            if (!strncmp(&row->render[i], scs, scs_len)) {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
-            }
+// hang `right` next to node on its level, counting its rows into the ancestors
+void lt_insert_after(struct lt_node* node, struct lt_node* right) {
+    right->prev = node;
+    right->next = node->next;
+    if (node->next) node->next->prev = right;
+    node->next = right;
+
+    struct lt_node* parent = node->parent;
+    if (parent == NULL) {
+        parent = lt_node_new(0);
+        parent->count = node->count;
+        lt_node_insert(parent, 0, node);
+        ES.lines = parent;
+    }
+    lt_node_insert(parent, lt_slot_of(parent, node) + 1, right);
+    struct lt_node* p;
+    for (p = parent; p; p = p->parent) p->count += right->count;
+    if (parent->n > LT_ORDER) lt_split(parent);
+}
+
+// merge underfull nodes into a neighbour and drop empty ones, then shrink the root
+void lt_rebalance(struct lt_node* node) {
+    struct lt_node* parent = node->parent;
+
+    if (parent == NULL) {
+        while (!ES.lines->leaf && ES.lines->n <= 1) {
+            struct lt_node* root = ES.lines;
+            ES.lines = root->n ? root->slot[0] : lt_node_new(1);
+            ES.lines->parent = NULL;
+            free(root);
         }
+        return;
+    }
+    if (node->n >= LT_ORDER / 4) return;
+
+    int i = lt_slot_of(parent, node);
+    if (node->n == 0) {
+        lt_unlink(node);
+        lt_node_remove(parent, i);
+        free(node);
+        lt_rebalance(parent);
+        return;
+    }
 
-        if (mcs_len && mce_len && !in_string) { // multiline comment
-            if (in_comment) {
-                row->hl[i] = HL_MLCOMMENT;
-                if (!strncmp(&row->render[i], mce, mce_len)) {
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_sep = 1;
-                    continue;
-                } else {
-                    i++;
-                    continue;
-                }
-            } else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-                i += mcs_len;
-                in_comment = 1;
-                continue;
+    struct lt_node* left = node;
+    struct lt_node* right;
+    if (i + 1 < parent->n) {
+        right = parent->slot[i + 1];
+    } else if (i > 0) {
+        left = parent->slot[--i];
+        right = node;
+    } else {
+        lt_rebalance(parent);
+        return;
+    }
+    if (left->n + right->n > LT_ORDER) return;
+
+    int j;
+    for (j = 0; j < right->n; j++) {
+        left->slot[left->n] = right->slot[j];
+        lt_adopt(left, left->n++);
+    }
+    left->count += right->count;
+    lt_unlink(right);
+    lt_node_remove(parent, i + 1);
+    free(right);
+    lt_rebalance(parent);
+}
+
+/* hang n rows from an empty tree at once, building it a level at a time.
+** nodes are left three quarters full so the first edits don't split them */
+void lt_build(erow* rows, int n) {
+    int fill = LT_ORDER / 4 * 3;
+    int count = (n + fill - 1) / fill;
+    if (count == 0) return;
+    struct lt_node** level = malloc(sizeof(struct lt_node*) * count);
+    int leaf = 1;
+    int total = n; // children to share out on this level
+    int i, j;
+    while (1) {
+        for (i = 0; i < count; i++) {
+            struct lt_node* node = lt_node_new(leaf);
+            // spread the children evenly so no node ends up underfull
+            for (j = (long long)total * i / count; j < (long long)total * (i + 1) / count; j++) {
+                node->slot[node->n] = leaf ? (void*)&rows[j] : (void*)level[j];
+                lt_adopt(node, node->n);
+                node->count += lt_weight(node, node->n++);
             }
+            if (i > 0) {
+                node->prev = level[i - 1];
+                level[i - 1]->next = node;
+            }
+            level[i] = node; // children were all taken from at or after i
         }
+        if (count == 1) break;
+        leaf = 0;
+        total = count;
+        count = (count + fill - 1) / fill;
+    }
 
-        if (ES.syntax->flags & HL_HIGHLIGHT_STRINGS) { // strings
-            if (in_string) {
-                row->hl[i] = HL_STRING;
-                if (c == '\\' && i + 1 < row->rsize) {
-                    row->hl[i+1] = HL_STRING;
-                    i+= 2;
-                    continue;
-                }
+    free(ES.lines);
+    ES.lines = level[0];
+    ES.numrows = n;
+    free(level);
+}
 
-                if (c == in_string) in_string = 0;
-                i++;
-                prev_sep = 1;
-                continue;
-            } else {
-                if (c == '"' || c == '\'') {
-                    in_string = c;
-                    row->hl[i] = HL_STRING;
-                    i++;
-                    continue;
-                }
-            }
+// descend to the leaf holding row `at`, leaving its position in the leaf in *pos
+struct lt_node* lt_find(int at, int* pos) {
+    struct lt_node* node = ES.lines;
+    while (!node->leaf) {
+        int i;
+        for (i = 0; i < node->n - 1; i++) {
+            int count = ((struct lt_node*)node->slot[i])->count;
+            if (at < count) break;
+            at -= count;
         }
+        node = node->slot[i];
+    }
+    *pos = at;
+    return node;
+}
 
-        if (ES.syntax->flags & HL_HIGHLIGHT_NUMBERS) { // numbers
-            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
-                (c == '.' && prev_hl == HL_NUMBER)) {
-                row->hl[i] = HL_NUMBER;
-                i++;
-                prev_sep = 0;
-                continue;
-            }
+void lt_insert(int at, erow* row) {
+    int pos;
+    struct lt_node* leaf = lt_find(at, &pos);
+    struct lt_node* node;
+
+    lt_node_insert(leaf, pos, row);
+    for (node = leaf; node; node = node->parent) node->count++;
+    if (leaf->n > LT_ORDER) lt_split(leaf);
+    ES.numrows++;
+}
+
+erow* lt_remove(int at) {
+    int pos;
+    struct lt_node* leaf = lt_find(at, &pos);
+    struct lt_node* node;
+    erow* row = leaf->slot[pos];
+
+    lt_node_remove(leaf, pos);
+    for (node = leaf; node; node = node->parent) node->count--;
+    lt_rebalance(leaf);
+    ES.numrows--;
+    return row;
+}
+
+/* insert n rows at `at` at once. if the leaf there can't take them it is
+** cut in two, and the rows and what followed them are spread over new
+** leaves hung after the first half, so a block of rows costs a descent and
+** a node per leaf's worth of rows rather than a descent per row */
+void lt_splice(int at, erow** rows, int n) {
+    int pos, i, j;
+    struct lt_node* leaf = lt_find(at, &pos);
+    struct lt_node* p;
+    ES.numrows += n;
+    if (leaf->n + n <= LT_ORDER) {
+        memmove(&leaf->slot[pos + n], &leaf->slot[pos], sizeof(void*) * (leaf->n - pos));
+        for (i = 0; i < n; i++) {
+            leaf->slot[pos + i] = rows[i];
+            lt_adopt(leaf, pos + i);
         }
+        leaf->n += n;
+        for (p = leaf; p; p = p->parent) p->count += n;
+        return;
+    }
 
-        if (prev_sep) { // keywords
-            int j;
-            for (j=0; keywords[j]; j++) {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen-1] == '|';
-                if (kw2) klen--;
-
-                if (!strncmp(&row->render[i], keywords[j], klen) &&
-                    is_separator(row->render[i + klen])) {
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    i += klen;
-                    break;
-                }
-            }
-            if (keywords[j] == NULL) {
-                prev_sep = 0;
-                continue;
-            }
+    void* tail[LT_ORDER + 1];
+    int ntail = leaf->n - pos;
+    memcpy(tail, &leaf->slot[pos], sizeof(void*) * ntail);
+    leaf->n = pos;
+    for (p = leaf; p; p = p->parent) p->count -= ntail;
+
+    int fill = LT_ORDER / 4 * 3;
+    int total = n + ntail;
+    int count = (total + fill - 1) / fill;
+    struct lt_node* last = leaf;
+    for (i = 0; i < count; i++) {
+        struct lt_node* node = lt_node_new(1);
+        // spread evenly, as lt_build does, so only a lone new leaf can be underfull
+        for (j = (long long)total * i / count; j < (long long)total * (i + 1) / count; j++) {
+            node->slot[node->n] = (j < n) ? (void*)rows[j] : tail[j - n];
+            lt_adopt(node, node->n++);
         }
+        node->count = node->n;
+        lt_insert_after(last, node);
+        last = node;
+    }
+    lt_rebalance(last); // before leaf, which can only absorb it
+    lt_rebalance(leaf);
+}
 
-        prev_sep = is_separator(c);
-        i++;
+/* take the n rows from `at` out of the tree at once, into rows. leaves it
+** empties are dropped as it passes them, the ones at either end are
+** rebalanced once it is done */
+void lt_remove_range(int at, int n, erow** rows) {
+    int pos, k = 0;
+    struct lt_node* leaf = lt_find(at, &pos);
+    struct lt_node* kept[2];
+    int nkept = 0;
+    struct lt_node* p;
+    ES.numrows -= n;
+    while (k < n) {
+        int take = (leaf->n - pos < n - k) ? leaf->n - pos : n - k;
+        memcpy(&rows[k], &leaf->slot[pos], sizeof(void*) * take);
+        memmove(&leaf->slot[pos], &leaf->slot[pos + take], sizeof(void*) * (leaf->n - pos - take));
+        leaf->n -= take;
+        k += take;
+        for (p = leaf; p; p = p->parent) p->count -= take;
+
+        struct lt_node* next = leaf->next;
+        if (leaf->n == 0 && leaf->parent) lt_rebalance(leaf);
+        else kept[nkept++] = leaf;
+        leaf = next;
+        pos = 0;
     }
+    // the later one first, rebalancing the earlier one can free it
+    while (nkept > 0) lt_rebalance(kept[--nkept]);
+}
 
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    if (changed && row->idx + 1 < ES.numrows) {
-        update_syntax(&ES.row[row->idx + 1]);
+erow* editor_row(int at) {
+    if (at < 0 || at >= ES.numrows) return NULL;
+    int pos;
+    struct lt_node* leaf = lt_find(at, &pos);
+    return leaf->slot[pos];
+}
+
+int editor_row_index(erow* row) {
+    struct lt_node* node = row->leaf;
+    int idx = lt_slot_of(node, row);
+    while (node->parent) {
+        struct lt_node* parent = node->parent;
+        int i;
+        for (i = 0; parent->slot[i] != node; i++) {
+            idx += ((struct lt_node*)parent->slot[i])->count;
+        }
+        node = parent;
     }
+    return idx;
+}
 
+erow* row_iter_get(struct row_iter* it) {
+    if (it->leaf == NULL) return NULL;
+    return it->leaf->slot[it->pos];
 }
 
-int syntax_to_color(int hl) {
-    switch (hl) {
-        case HL_MLCOMMENT:
-        case HL_COMMENT: return 36;
-        case HL_KEYWORD1: return 33;
-        case HL_KEYWORD2: return 32;
-        case HL_STRING: return 35;
-        case HL_NUMBER: return 31;
-        case HL_MATCH: return 34;
-        default: return 37;
+erow* row_iter_seek(struct row_iter* it, int at) {
+    it->leaf = NULL;
+    if (at < 0 || at >= ES.numrows) return NULL;
+    it->leaf = lt_find(at, &it->pos);
+    return row_iter_get(it);
+}
+
+erow* row_iter_from(struct row_iter* it, erow* row) {
+    it->leaf = row->leaf;
+    it->pos = lt_slot_of(row->leaf, row);
+    return row;
+}
+
+erow* row_iter_next(struct row_iter* it) {
+    if (it->leaf == NULL) return NULL;
+    if (++it->pos >= it->leaf->n) {
+        it->leaf = it->leaf->next;
+        it->pos = 0;
     }
+    return row_iter_get(it);
 }
 
-void select_syntax_highlight() {
-    ES.syntax = NULL;
-    if (ES.filename == NULL) return;
+erow* row_iter_prev(struct row_iter* it) {
+    if (it->leaf == NULL) return NULL;
+    if (--it->pos < 0) {
+        it->leaf = it->leaf->prev;
+        it->pos = it->leaf ? it->leaf->n - 1 : 0;
+    }
+    return row_iter_get(it);
+}
 
-    char* ext = strrchr(ES.filename, '.');
+erow* editor_row_next(erow* row) {
+    struct row_iter it;
+    row_iter_from(&it, row);
+    return row_iter_next(&it);
+}
 
-    for (unsigned int j=0; j < HLDB_ENTRIES; j++) {
-        struct editor_syntax* syn = &HLDB[j];
-        unsigned int i = 0;
-        while (syn->filematch[i]) {
-            int is_ext = (syn->filematch[i][0] == '.');
-            if ((is_ext && ext && !strcmp(ext, syn->filematch[i])) ||
-                (!is_ext && strstr(ES.filename, syn->filematch[i]))) {
-                ES.syntax = syn;
+erow* editor_row_prev(erow* row) {
+    struct row_iter it;
+    row_iter_from(&it, row);
+    return row_iter_prev(&it);
+}
 
-                int filerow;
-                for (filerow = 0; filerow < ES.numrows; filerow++) {
-                    update_syntax(&ES.row[filerow]);
-                }
+/* syntax highlighting */
+int is_separator(int c) {
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
 
-                return;
+unsigned int syntax_hash(unsigned int seed, const char* s, int len) {
+    unsigned int h = seed;
+    int i;
+    for (i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+// try to give every keyword its own slot in a table of mask + 1 slots
+int syntax_place_keywords(struct syntax_lexer* lx, unsigned int mask, unsigned int seed) {
+    char** keywords = lx->syntax->keywords;
+    int j;
+
+    memset(lx->kw, 0, sizeof(struct syntax_keyword) * (mask + 1));
+    for (j = 0; keywords[j]; j++) {
+        int len = strlen(keywords[j]);
+        int kw2 = keywords[j][len - 1] == '|';
+        if (kw2) len--;
+
+        struct syntax_keyword* kw = &lx->kw[syntax_hash(seed, keywords[j], len) & mask];
+        if (kw->word) return -1;
+        kw->word = keywords[j];
+        kw->len = len;
+        kw->hl = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+    }
+    lx->kwmask = mask;
+    lx->kwseed = seed;
+    return 0;
+}
+
+/* compile a syntax into character classes and a collision free keyword
+** table, so lexing is one pass whatever the number of keywords.
+** keywords may not contain separators, quotes or comment delimiters */
+void syntax_compile(struct syntax_lexer* lx, struct editor_syntax* syn) {
+    char** keywords = syn->keywords;
+    int c, j;
+
+    lx->syntax = syn;
+    lx->scs = syn->singleline_comment_start;
+    lx->mcs = syn->multiline_comment_start;
+    lx->mce = syn->multiline_comment_end;
+    lx->scs_len = lx->scs ? strlen(lx->scs) : 0;
+    lx->mcs_len = (lx->mcs && lx->mce) ? strlen(lx->mcs) : 0;
+    lx->mce_len = (lx->mcs && lx->mce) ? strlen(lx->mce) : 0;
+
+    lx->reach = 2; // string escapes
+    if (lx->scs_len > lx->reach) lx->reach = lx->scs_len;
+    if (lx->mcs_len > lx->reach) lx->reach = lx->mcs_len;
+    if (lx->mce_len > lx->reach) lx->reach = lx->mce_len;
+
+    memset(lx->cclass, 0, sizeof(lx->cclass));
+    for (c = 0; c < 256; c++) {
+        if (is_separator(c)) lx->cclass[c] |= CC_SEPARATOR;
+        if (isdigit(c)) lx->cclass[c] |= CC_DIGIT;
+    }
+    if (syn->flags & HL_HIGHLIGHT_STRINGS) {
+        lx->cclass['"'] |= CC_QUOTE;
+        lx->cclass['\''] |= CC_QUOTE;
+    }
+    if (lx->scs_len) lx->cclass[(unsigned char)lx->scs[0]] |= CC_DELIM;
+    if (lx->mcs_len) lx->cclass[(unsigned char)lx->mcs[0]] |= CC_DELIM;
+    if (lx->mce_len) lx->cclass[(unsigned char)lx->mce[0]] |= CC_DELIM;
+
+    unsigned int nkeywords = 0;
+    lx->kw_maxlen = 0;
+    for (j = 0; keywords[j]; j++, nkeywords++) {
+        const char* k;
+        for (k = keywords[j]; *k && *k != '|'; k++) {
+            if (!(lx->cclass[(unsigned char)*k] & (CC_SEPARATOR | CC_QUOTE | CC_DELIM))) {
+                lx->cclass[(unsigned char)*k] |= CC_KEYWORD;
             }
-            i++;
+        }
+        if (k - keywords[j] > lx->kw_maxlen) lx->kw_maxlen = k - keywords[j];
+    }
+
+    unsigned int size = 1;
+    while (size < 2 * nkeywords) size *= 2;
+    for (;; size *= 2) {
+        unsigned int seed;
+        lx->kw = realloc(lx->kw, sizeof(struct syntax_keyword) * size);
+        for (seed = 1; seed <= 256; seed++) {
+            if (syntax_place_keywords(lx, size - 1, seed * 2166136261u) == 0) return;
+        }
+    }
+}
+
+int syntax_keyword(struct syntax_lexer* lx, const char* s, int len) {
+    if (len > lx->kw_maxlen) return HL_NORMAL;
+    struct syntax_keyword* kw = &lx->kw[syntax_hash(lx->kwseed, s, len) & lx->kwmask];
+    if (kw->word && kw->len == len && !memcmp(kw->word, s, len)) return kw->hl;
+    return HL_NORMAL;
+}
+
+void hl_save_checkpoint(erow* row, struct hl_state st) {
+    if (row->nhlcp > 0 && row->hlcp[row->nhlcp - 1].pos >= st.pos) return; // lexing again from an earlier one
+    if ((row->nhlcp & (row->nhlcp - 1)) == 0) { // grow at powers of two
+        row->hlcp = realloc(row->hlcp, sizeof(struct hl_state) * (row->nhlcp ? row->nhlcp * 2 : 1));
+    }
+    row->hlcp[row->nhlcp++] = st;
+}
+
+/* lex render text s, which holds the row's render columns [base, base + n),
+** from s[i] in state st, writing hl[i, n). a state is saved every `every`
+** columns up to s[keep], past which the lexer may have been misled by s
+** ending before the row does. returns the comment state it ends in */
+int syntax_lex(erow* row, const char* s, unsigned char* hl, int n, int base, int i, struct hl_state st, int every, int keep) {
+    struct syntax_lexer* lx = ES.lexer;
+    const unsigned char* cc = lx->cclass;
+    int numbers = lx->syntax->flags & HL_HIGHLIGHT_NUMBERS;
+
+    int prev_sep = st.prev_sep;
+    int in_string = st.in_string;
+    int in_comment = st.in_comment;
+    int line_comment = st.line_comment;
+    int start = i;
+    memset(&hl[i], HL_NORMAL, n - i);
+
+    int next_checkpoint = ((base + i) / every + 1) * every;
+    while (i < n) {
+        unsigned char c = s[i];
+        if (base + i >= next_checkpoint) {
+            if (i <= keep) {
+                struct hl_state at = { base + i, in_string, in_comment, line_comment, prev_sep,
+                                       i > start ? hl[i - 1] : st.prev_hl };
+                hl_save_checkpoint(row, at);
+            }
+            next_checkpoint = ((base + i) / every + 1) * every;
+        }
+
+        if (line_comment) { // to the end of the row, a checkpoint at a time
+            int end = (next_checkpoint - base < n) ? next_checkpoint - base : n;
+            memset(&hl[i], HL_COMMENT, end - i);
+            i = end;
+            continue;
+        }
+
+        if (in_comment) { // multiline comment
+            if ((cc[c] & CC_DELIM) && i + lx->mce_len <= n && !memcmp(&s[i], lx->mce, lx->mce_len)) {
+                memset(&hl[i], HL_MLCOMMENT, lx->mce_len);
+                i += lx->mce_len;
+                in_comment = 0;
+                prev_sep = 1;
+            } else {
+                hl[i++] = HL_MLCOMMENT;
+            }
+            continue;
+        }
+
+        if (in_string) { // strings
+            hl[i] = HL_STRING;
+            if (c == '\\' && i + 1 < n) {
+                hl[i+1] = HL_STRING;
+                i += 2;
+                continue;
+            }
+            if (c == in_string) in_string = 0;
+            i++;
+            prev_sep = 1;
+            continue;
+        }
+
+        if (cc[c] & CC_DELIM) { // comment starts
+            if (lx->scs_len && i + lx->scs_len <= n && !memcmp(&s[i], lx->scs, lx->scs_len)) {
+                line_comment = 1;
+                continue;
+            }
+            if (lx->mcs_len && i + lx->mcs_len <= n && !memcmp(&s[i], lx->mcs, lx->mcs_len)) {
+                memset(&hl[i], HL_MLCOMMENT, lx->mcs_len);
+                i += lx->mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if (cc[c] & CC_QUOTE) {
+            in_string = c;
+            hl[i++] = HL_STRING;
+            continue;
+        }
+
+        if (numbers) {
+            unsigned char prev_hl = (i > start) ? hl[i-1] : st.prev_hl;
+            if (((cc[c] & CC_DIGIT) && (prev_sep || prev_hl == HL_NUMBER)) ||
+                (c == '.' && prev_hl == HL_NUMBER)) {
+                hl[i++] = HL_NUMBER;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        if (prev_sep && (cc[c] & CC_KEYWORD)) { // a word that may be a keyword
+            // past the longest keyword it can't be one, and the rest of it lexes as plain text
+            int j = i + 1;
+            while (j < n && j - i <= lx->kw_maxlen && (cc[(unsigned char)s[j]] & CC_KEYWORD)) j++;
+            if (j - i <= lx->kw_maxlen && (j == n || (cc[(unsigned char)s[j]] & CC_SEPARATOR))) {
+                int kw = syntax_keyword(lx, &s[i], j - i);
+                if (kw != HL_NORMAL) memset(&hl[i], kw, j - i);
+            }
+            i = j;
+            prev_sep = 0;
+            continue;
+        }
+
+        prev_sep = cc[c] & CC_SEPARATOR;
+        i++;
+    }
+    return in_comment;
+}
+
+int syntax_long_from(erow* row, int from);
+
+// highlight row from render column `from`, everything before it is unchanged.
+// returns whether the comment state the row ends in changed
+int update_syntax_from(erow* row, int from) {
+    struct syntax_lexer* lx = ES.lexer;
+    struct prof_probe p;
+    int changed = 0;
+    PROF_BEGIN(&p);
+    if (row->flags & ROW_LONG) {
+        changed = syntax_long_from(row, from);
+    } else if (lx == NULL) {
+        memset(&row->hl[from], HL_NORMAL, row->rsize - from);
+    } else {
+        // resume from the last checkpoint the lexer can't have read past `from` to reach
+        struct hl_state st = { 0, 0, row->hl_start, 0, 1, HL_NORMAL };
+        while (row->nhlcp > 0 && row->hlcp[row->nhlcp - 1].pos + lx->reach > from) row->nhlcp--;
+        if (row->nhlcp > 0) st = row->hlcp[row->nhlcp - 1];
+
+        int in_comment = syntax_lex(row, row->render, row->hl, row->rsize, 0, st.pos, st, HL_CHECKPOINT, row->rsize);
+        changed = (row->hl_open_comment != in_comment);
+        row->hl_open_comment = in_comment;
+    }
+    PROF_END(&p, PROF_SYNTAX, 1);
+    return changed;
+}
+
+int update_syntax(erow* row) {
+    return update_syntax_from(row, 0);
+}
+
+// the comment state a row ends in, lexed from chars column i without building hl
+int syntax_end_state(erow* row, int i, int in_comment, int in_string) {
+    struct syntax_lexer* lx = ES.lexer;
+    if (lx == NULL || !lx->mcs_len) return 0;
+
+    const unsigned char* cc = lx->cclass;
+    const char* s = row_chars(row);
+    int n = row->size;
+    while (i < n) {
+        unsigned char c = s[i];
+        if (in_comment) {
+            const char* end = memchr(&s[i], lx->mce[0], n - i);
+            if (end == NULL) break;
+            i = end - s;
+            if (i + lx->mce_len <= n && !memcmp(&s[i], lx->mce, lx->mce_len)) {
+                i += lx->mce_len;
+                in_comment = 0;
+            } else {
+                i++;
+            }
+        } else if (in_string) {
+            if (c == '\\' && i + 1 < n) {
+                i += 2;
+                continue;
+            }
+            if (c == in_string) in_string = 0;
+            i++;
+        } else if (!(cc[c] & (CC_DELIM | CC_QUOTE))) {
+            i++;
+        } else if (lx->scs_len && i + lx->scs_len <= n && !memcmp(&s[i], lx->scs, lx->scs_len)) {
+            return 0;
+        } else if (i + lx->mcs_len <= n && !memcmp(&s[i], lx->mcs, lx->mcs_len)) {
+            i += lx->mcs_len;
+            in_comment = 1;
+        } else {
+            if (cc[c] & CC_QUOTE) in_string = c;
+            i++;
+        }
+    }
+    return in_comment;
+}
+
+/* a long row changed from render column `from`. the states saved past it
+** are stale and its window is built again when drawn, the state it ends in
+** is lexed from chars, resuming from the last state still good */
+int syntax_long_from(erow* row, int from) {
+    struct syntax_lexer* lx = ES.lexer;
+    row->rstart = 0;
+    row->rsize = 0;
+    if (lx == NULL) return 0;
+
+    int in_comment;
+    while (row->nhlcp > 0 && row->hlcp[row->nhlcp - 1].pos + lx->reach > from) row->nhlcp--;
+    if (row->nhlcp > 0) {
+        struct hl_state* st = &row->hlcp[row->nhlcp - 1];
+        in_comment = st->line_comment ? 0 :
+            syntax_end_state(row, editor_row_rxtocx(row, st->pos), st->in_comment, st->in_string);
+    } else {
+        in_comment = syntax_end_state(row, 0, row->hl_start, 0);
+    }
+    int changed = (row->hl_open_comment != in_comment);
+    row->hl_open_comment = in_comment;
+    return changed;
+}
+
+// lex a row as starting in `in_comment`, building hl only if it has a current one
+void syntax_lex_row(erow* row, int in_comment, int with_hl) {
+    row->hl_start = in_comment;
+    row->state_gen = ES.hl_gen;
+    if (with_hl) {
+        if (row->hl == NULL) row->hl = malloc(row->rcap);
+        row->nhlcp = 0;
+        update_syntax(row);
+        row->hl_gen = ES.hl_gen;
+    } else {
+        struct prof_probe p;
+        PROF_BEGIN(&p);
+        row->hl_gen = 0;
+        row->hl_open_comment = syntax_end_state(row, 0, in_comment, 0);
+        PROF_END(&p, PROF_SYNTAX, 1);
+    }
+}
+
+void syntax_invalidate_from(int at) {
+    if (at < ES.hl_frontier) ES.hl_frontier = at;
+    idle_schedule(syntax_idle);
+}
+
+/* walk rows [ES.hl_frontier, at), re-lexing only those whose start state
+** moved or whose text changed since they were lexed */
+void syntax_catch_up(int at) {
+    if (ES.hl_frontier >= at) return;
+
+    struct row_iter it;
+    erow* row = row_iter_seek(&it, ES.hl_frontier);
+    erow* prev = editor_row(ES.hl_frontier - 1);
+    int in_comment = prev ? prev->hl_open_comment : 0;
+    for (; ES.hl_frontier < at; ES.hl_frontier++, row = row_iter_next(&it)) {
+        if (row->state_gen != ES.hl_gen || row->hl_start != in_comment) {
+            syntax_lex_row(row, in_comment, 0);
+        }
+        in_comment = row->hl_open_comment;
+    }
+}
+
+// an idle task, lexes stale rows below the frontier a slice at a time so
+// jumping past them later doesn't have to
+void syntax_idle() {
+    int at = ES.hl_frontier + IDLE_ROWS;
+    syntax_catch_up(at < ES.numrows ? at : ES.numrows);
+    if (ES.hl_frontier < ES.numrows) idle_schedule(syntax_idle);
+}
+
+/* row `at` now ends in a different state. re-lex the rows below it on
+** screen until one starts in the state it was lexed with, and leave the
+** rest to syntax_catch_up, so one keypress costs at most a screenful */
+void syntax_propagate(erow* row, int at) {
+    if (at >= ES.hl_frontier) return; // already stale below
+
+    int in_comment = row->hl_open_comment;
+    int bottom = ES.rowoff + ES.screenrows + HL_LOOKAHEAD;
+    struct row_iter it;
+    row_iter_from(&it, row);
+    while ((row = row_iter_next(&it)) != NULL) {
+        at++;
+        if (row->state_gen == ES.hl_gen && row->hl_start == in_comment) return;
+        if (at < ES.rowoff || at >= bottom) {
+            syntax_invalidate_from(at);
+            return;
+        }
+        syntax_lex_row(row, in_comment, row->hl_gen == ES.hl_gen);
+        in_comment = row->hl_open_comment;
+    }
+}
+
+// make sure row `at` has a current hl, lexing only what it depends on
+void editor_highlight_row(erow* row, int at) {
+    editor_render_row(row);
+    syntax_catch_up(at);
+
+    erow* prev = editor_row_prev(row);
+    int in_comment = prev ? prev->hl_open_comment : 0;
+    if (row->hl_gen != ES.hl_gen || row->hl_start != in_comment) {
+        syntax_lex_row(row, in_comment, 1);
+    }
+    if (ES.hl_frontier == at) ES.hl_frontier = at + 1;
+}
+
+int syntax_to_color(int hl) {
+    switch (hl) {
+        case HL_MLCOMMENT:
+        case HL_COMMENT: return 36;
+        case HL_KEYWORD1: return 33;
+        case HL_KEYWORD2: return 32;
+        case HL_STRING: return 35;
+        case HL_NUMBER: return 31;
+        case HL_MATCH: return 34;
+        default: return 37;
+    }
+}
+
+void select_syntax_highlight() {
+    ES.syntax = NULL;
+    ES.lexer = NULL;
+    ES.hl_gen++; // rows are re-lexed as they are drawn, or when idle
+    ES.hl_frontier = 0;
+    idle_schedule(syntax_idle);
+    if (ES.filename == NULL) return;
+
+    char* ext = strrchr(ES.filename, '.');
+
+    for (unsigned int j=0; j < HLDB_ENTRIES; j++) {
+        struct editor_syntax* syn = &HLDB[j];
+        unsigned int i = 0;
+        while (syn->filematch[i]) {
+            int is_ext = (syn->filematch[i][0] == '.');
+            if ((is_ext && ext && !strcmp(ext, syn->filematch[i])) ||
+                (!is_ext && strstr(ES.filename, syn->filematch[i]))) {
+                ES.syntax = syn;
+                ES.lexer = &HLLEX[j];
+                if (ES.lexer->syntax == NULL) syntax_compile(ES.lexer, syn);
+                return;
+            }
+            i++;
+        }
+    }
+}
+
+/* undo */
+/* edits are journaled as they reach the row primitives. records are packed
+** into one arena with their text, and a record can grow while the same
+** kind of edit continues where it left off, so a typed word or a pasted
+** block of rows is a single record */
+#define UNDO_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct undo_record* undo_at(int i) {
+    return (struct undo_record*)&ES.undo.arena[ES.undo.recs[i]];
+}
+
+char* undo_text(struct undo_record* rec) {
+    return (char*)(rec + 1);
+}
+
+// the record the next edit may extend, if it belongs to the same command or
+// was the only record of the one before
+struct undo_record* undo_last(int type) {
+    if (ES.undo.suspended || ES.undo.cur == 0 || ES.undo.cur != ES.undo.nrecs) return NULL;
+    struct undo_record* rec = undo_at(ES.undo.cur - 1);
+    if (rec->type != type) return NULL;
+    if (rec->group == ES.undo.group) return rec;
+    if (type != UNDO_INSERT_CHARS || rec->group != ES.undo.group - 1) return NULL;
+    if (ES.undo.cur > 1 && undo_at(ES.undo.cur - 2)->group == rec->group) return NULL;
+    rec->group = ES.undo.group;
+    return rec;
+}
+
+void undo_reserve(size_t len) {
+    if (len <= ES.undo.cap) return;
+    size_t cap = ES.undo.cap ? ES.undo.cap : 4096;
+    while (cap < len) cap *= 2;
+    ES.undo.arena = realloc(ES.undo.arena, cap);
+    if (ES.undo.arena == NULL) die("realloc");
+    ES.undo.cap = cap;
+}
+
+// add text to the end of the newest record, which may move
+struct undo_record* undo_extend(const char* s, size_t len) {
+    undo_reserve(ES.undo.len + len);
+    struct undo_record* rec = undo_at(ES.undo.nrecs - 1);
+    memcpy(&ES.undo.arena[ES.undo.len], s, len);
+    rec->len += len;
+    ES.undo.len += len;
+    return rec;
+}
+
+// forget the oldest commands until the journal is back under UNDO_LIMIT
+void undo_evict() {
+    if (ES.undo.len <= UNDO_LIMIT) return;
+
+    int newest = undo_at(ES.undo.nrecs - 1)->group;
+    int drop = 0;
+    while (drop < ES.undo.nrecs && ES.undo.len - ES.undo.recs[drop] > UNDO_LIMIT / 4 * 3) {
+        int group = undo_at(drop)->group;
+        if (group == newest) break;
+        while (drop < ES.undo.nrecs && undo_at(drop)->group == group) drop++;
+    }
+    if (drop == 0) return;
+    if (drop > ES.undo.cur) drop = ES.undo.cur; // never drop what could be redone
+
+    size_t base = (drop < ES.undo.nrecs) ? ES.undo.recs[drop] : ES.undo.len;
+    memmove(ES.undo.arena, &ES.undo.arena[base], ES.undo.len - base);
+    ES.undo.len -= base;
+    int j;
+    for (j = drop; j < ES.undo.nrecs; j++) ES.undo.recs[j - drop] = ES.undo.recs[j] - base;
+    ES.undo.nrecs -= drop;
+    ES.undo.cur -= drop;
+}
+
+struct undo_record* undo_push(int type, int y, int x, const char* s, size_t len) {
+    if (ES.undo.nrecs > ES.undo.cur) { // a new edit drops what could be redone
+        ES.undo.len = ES.undo.recs[ES.undo.cur];
+        ES.undo.nrecs = ES.undo.cur;
+    }
+    if (ES.undo.nrecs == ES.undo.reccap) {
+        ES.undo.reccap = ES.undo.reccap ? ES.undo.reccap * 2 : 256;
+        ES.undo.recs = realloc(ES.undo.recs, sizeof(size_t) * ES.undo.reccap);
+        if (ES.undo.recs == NULL) die("realloc");
+    }
+
+    size_t off = UNDO_ALIGN(ES.undo.len);
+    undo_reserve(off + sizeof(struct undo_record) + len);
+    struct undo_record* rec = (struct undo_record*)&ES.undo.arena[off];
+    rec->type = type;
+    rec->group = ES.undo.group;
+    rec->y = y;
+    rec->x = x;
+    rec->n = 0;
+    rec->len = len;
+    rec->cx = ES.undo.cx;
+    rec->cy = ES.undo.cy;
+    rec->cx_after = ES.cx;
+    rec->cy_after = ES.cy;
+    memcpy(undo_text(rec), s, len);
+    ES.undo.len = off + sizeof(struct undo_record) + len;
+    ES.undo.recs[ES.undo.nrecs++] = off;
+    ES.undo.cur = ES.undo.nrecs;
+    return rec;
+}
+
+void undo_insert_chars(erow* row, int at, const char* s, size_t len) {
+    if (ES.undo.suspended) return;
+    int y = editor_row_index(row);
+    struct undo_record* rec = undo_last(UNDO_INSERT_CHARS);
+    if (rec && rec->y == y && (size_t)at == rec->x + rec->len) {
+        undo_extend(s, len);
+    } else {
+        undo_push(UNDO_INSERT_CHARS, y, at, s, len);
+    }
+    undo_evict();
+}
+
+void undo_delete_chars(erow* row, int at, const char* s, size_t len) {
+    if (ES.undo.suspended) return;
+    undo_push(UNDO_DELETE_CHARS, editor_row_index(row), at, s, len);
+    undo_evict();
+}
+
+// rows are kept in a record as lines ending in '\n'
+void undo_insert_row(int at, const char* s, size_t len) {
+    if (ES.undo.suspended) return;
+    struct undo_record* rec = undo_last(UNDO_INSERT_ROWS);
+    if (rec && at == rec->y + rec->n) {
+        undo_extend(s, len);
+    } else {
+        undo_push(UNDO_INSERT_ROWS, at, 0, s, len);
+    }
+    undo_extend("\n", 1)->n++;
+    undo_evict();
+}
+
+// s holds n rows as lines ending in '\n'
+void undo_insert_rows(int at, const char* s, size_t len, int n) {
+    if (ES.undo.suspended) return;
+    struct undo_record* rec = undo_last(UNDO_INSERT_ROWS);
+    if (rec && at == rec->y + rec->n) {
+        rec = undo_extend(s, len);
+    } else {
+        rec = undo_push(UNDO_INSERT_ROWS, at, 0, s, len);
+    }
+    rec->n += n;
+    undo_evict();
+}
+
+void undo_delete_row(int at, const char* s, size_t len) {
+    if (ES.undo.suspended) return;
+    struct undo_record* rec = undo_last(UNDO_DELETE_ROWS);
+    if (rec && at == rec->y) {
+        undo_extend(s, len);
+    } else {
+        undo_push(UNDO_DELETE_ROWS, at, 0, s, len);
+    }
+    undo_extend("\n", 1)->n++;
+    undo_evict();
+}
+
+/* a replace holds the text that replaced every match, then its spans: each
+** a find_match for where the match was before the replace, followed by the
+** text it covered. rows can be added while the replacement is the same */
+void undo_replace(int y, const char* with, int wlen, const char* spans, size_t len) {
+    if (ES.undo.suspended) return;
+    struct undo_record* rec = undo_last(UNDO_REPLACE);
+    if (rec == NULL || rec->x != wlen || memcmp(undo_text(rec), with, wlen)) {
+        undo_push(UNDO_REPLACE, y, wlen, with, wlen);
+    }
+    undo_extend(spans, len)->n++;
+    undo_evict();
+}
+
+// start a new command, edits made until the next one are undone together
+void undo_begin() {
+    ES.undo.group++;
+    ES.undo.cx = ES.cx;
+    ES.undo.cy = ES.cy;
+}
+
+// remember where the command left the cursor, for redo
+void undo_end() {
+    if (ES.undo.cur == 0) return;
+    struct undo_record* rec = undo_at(ES.undo.cur - 1);
+    if (rec->group != ES.undo.group) return;
+    rec->cx_after = ES.cx;
+    rec->cy_after = ES.cy;
+}
+
+void undo_clear() {
+    ES.undo.len = 0;
+    ES.undo.nrecs = 0;
+    ES.undo.cur = 0;
+}
+
+/* swap */
+/* every edit is also appended to .<name>.swp as a small binary record:
+** the edit type, then row, column and length as varints, then any inserted
+** text. a row record holds one row, or when its column is set, that many
+** rows as lines ending in '\n'. records collect in memory and are written
+** when input goes idle, so typing costs a few bytes and no system calls.
+** the swap is emptied on save and removed on quit, one left behind means
+** unsaved work */
+#define SWAP_MAGIC "INNSWAP1"
+#define SWAP_FLUSH_AT (1 << 20) // bytes of pending records that are written without waiting for idle
+
+struct swap_header {
+    char magic[8];
+    long long size; // the file the edits apply to
+    long long mtime;
+};
+
+char* swap_name(const char* filename) {
+    const char* base = strrchr(filename, '/');
+    int dirlen = base ? base - filename + 1 : 0;
+    base = base ? base + 1 : filename;
+    char* name = malloc(dirlen + strlen(base) + sizeof("..swp"));
+    sprintf(name, "%.*s.%s.swp", dirlen, filename, base);
+    return name;
+}
+
+void swap_put_varint(unsigned long v) {
+    while (v >= 0x80) {
+        ES.swap.buf[ES.swap.len++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    ES.swap.buf[ES.swap.len++] = v;
+}
+
+void swap_flush() {
+    if (ES.swap.fd == -1 || ES.swap.len == 0) return;
+    struct iovec iov = { ES.swap.buf, ES.swap.len };
+    ES.swap.len = 0;
+    if (writev_all(ES.swap.fd, &iov, 1) == -1 || fdatasync(ES.swap.fd) == -1) {
+        editor_set_statusmessage("swap file write failed, changes are no longer journaled: %s", strerror(errno));
+        close(ES.swap.fd);
+        ES.swap.fd = -1;
+    }
+}
+
+// a record whose text is a then b, a NULL part is counted in the length but not written
+void swap_record_parts(int type, int y, int x, const char* a, size_t alen, const char* b, size_t blen) {
+    if (ES.swap.fd == -1) return;
+    size_t need = ES.swap.len + 1 + 3 * 10 + (a ? alen : 0) + (b ? blen : 0);
+    if (need > ES.swap.cap) {
+        ES.swap.cap = (ES.swap.cap * 2 > need) ? ES.swap.cap * 2 : need;
+        ES.swap.buf = realloc(ES.swap.buf, ES.swap.cap);
+        if (ES.swap.buf == NULL) die("realloc");
+    }
+    ES.swap.buf[ES.swap.len++] = type;
+    swap_put_varint(y);
+    swap_put_varint(x);
+    swap_put_varint(alen + blen);
+    if (a) {
+        memcpy(&ES.swap.buf[ES.swap.len], a, alen);
+        ES.swap.len += alen;
+    }
+    if (b) {
+        memcpy(&ES.swap.buf[ES.swap.len], b, blen);
+        ES.swap.len += blen;
+    }
+    if (ES.swap.len >= SWAP_FLUSH_AT) swap_flush();
+    else idle_schedule(swap_flush);
+}
+
+void swap_record(int type, int y, int x, const char* s, size_t len) {
+    swap_record_parts(type, y, x, s, len, NULL, 0);
+}
+
+// start journaling against the file as it is on disk now
+void swap_start() {
+    struct stat st;
+    if (ES.filename == NULL || stat(ES.filename, &st) == -1) return;
+
+    free(ES.swap.name);
+    ES.swap.name = swap_name(ES.filename);
+    ES.swap.fd = open(ES.swap.name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ES.swap.len = 0;
+    if (ES.swap.fd == -1) return;
+
+    struct swap_header h;
+    memcpy(h.magic, SWAP_MAGIC, 8);
+    h.size = st.st_size;
+    h.mtime = st.st_mtime;
+    if (write(ES.swap.fd, &h, sizeof(h)) != sizeof(h)) {
+        close(ES.swap.fd);
+        ES.swap.fd = -1;
+    }
+}
+
+// stop journaling, the swap is only worth keeping if the session died
+void swap_stop() {
+    if (ES.swap.fd == -1) return;
+    close(ES.swap.fd);
+    unlink(ES.swap.name);
+    ES.swap.fd = -1;
+    ES.swap.len = 0;
+}
+
+/* row operations */
+// how many of the row's tabs come before chars column cx
+int row_tabs_before(erow* row, int cx) {
+    int lo = 0, hi = row->ntabs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->tabs[mid].cx < cx) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int editor_row_cxtorx(erow* row, int cx) {
+    editor_render_row(row);
+    if (row->ntabs == 0) return cx;
+    int k = row_tabs_before(row, cx);
+    if (k == 0) return cx;
+    return row->tabs[k - 1].rx + (cx - row->tabs[k - 1].cx - 1);
+}
+
+int editor_row_rxtocx(erow* row, int rx) {
+    editor_render_row(row);
+    int cx = rx;
+    if (row->ntabs > 0) {
+        // the last tab that ends at or before rx, the chars after it are one column each
+        int lo = 0, hi = row->ntabs;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (row->tabs[mid].rx <= rx) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo > 0) cx = row->tabs[lo - 1].cx + 1 + (rx - row->tabs[lo - 1].rx);
+        if (lo < row->ntabs && cx > row->tabs[lo].cx) cx = row->tabs[lo].cx; // rx is inside its spaces
+    }
+    return cx < row->size ? cx : row->size;
+}
+
+// rebuild the tab index from chars column `at`, which starts at render column rx
+void row_index_tabs(erow* row, int at, int rx) {
+    row->ntabs = row_tabs_before(row, at);
+    int cx = at;
+    int seg;
+    for (seg = 0; seg < 2; seg++) { // either side of the gap
+        int lo = seg ? (at > row->gap ? at : row->gap) : at;
+        int hi = seg ? row->size : row->gap;
+        const char* base = seg ? row->chars + row->gaplen : row->chars;
+        const char* p = base + lo;
+        while (lo < hi && (p = memchr(p, '\t', base + hi - p)) != NULL) {
+            if (row->ntabs == row->tabcap) {
+                row->tabcap = row->tabcap ? row->tabcap * 2 : 8;
+                row->tabs = realloc(row->tabs, sizeof(struct row_tab) * row->tabcap);
+                if (row->tabs == NULL) die("realloc");
+            }
+            rx += (p - base) - cx;
+            rx = (rx / TAB_STOP + 1) * TAB_STOP;
+            cx = (p - base) + 1;
+            row->tabs[row->ntabs].cx = cx - 1;
+            row->tabs[row->ntabs++].rx = rx;
+            p++;
+        }
+    }
+}
+
+// make room for n render columns in render and hl
+void row_reserve_render(erow* row, int n) {
+    if (n + 1 > row->rcap) {
+        row->rcap = (row->rcap * 2 > n + 1) ? row->rcap * 2 : n + 1;
+        row->render = realloc(row->render, row->rcap);
+        if (row->hl) row->hl = realloc(row->hl, row->rcap);
+        if (row->render == NULL) die("realloc");
+    }
+}
+
+// render chars from column cx, which starts at render column rx, into out. returns the columns written, at most n
+int row_render_span(erow* row, int cx, int rx, char* out, int n) {
+    int idx = 0;
+    for (; cx < row->size && idx < n; cx++) {
+        char c = ROW_CHAR(row, cx);
+        if (c == '\t') {
+            out[idx++] = ' ';
+            while ((rx + idx) % TAB_STOP != 0 && idx < n) out[idx++] = ' ';
+        } else {
+            out[idx++] = c;
+        }
+    }
+    return idx;
+}
+
+// rebuild render from chars column `at`, everything before it is unchanged.
+// returns the render column the rebuild started at
+int update_render_from(erow* row, int at) {
+    if (row->render == NULL) at = 0;
+    int rx = at ? editor_row_cxtorx(row, at) : 0;
+    row_index_tabs(row, at, rx);
+
+    if (row->size >= LONG_LINE) { // windows of it are rendered when drawn
+        row->flags |= ROW_LONG;
+        row->rstart = 0;
+        row->rsize = 0;
+        row_reserve_render(row, 0);
+        return rx;
+    }
+    if (row->flags & ROW_LONG) { // render held a window, render it whole
+        row->flags &= ~ROW_LONG;
+        row->rstart = 0;
+        at = 0;
+        rx = 0;
+    }
+
+    int rlen = row->size;
+    if (row->ntabs) rlen = row->tabs[row->ntabs - 1].rx + (row->size - row->tabs[row->ntabs - 1].cx - 1);
+    row_reserve_render(row, rlen);
+    row->rsize = rx + row_render_span(row, at, rx, &row->render[rx], rlen - rx);
+    row->render[row->rsize] = '\0';
+    return rx;
+}
+
+// the row's text changed from chars column `at`
+void update_row_from(erow* row, int at) {
+    int rx = update_render_from(row, at);
+
+    if (row->hl_gen != ES.hl_gen) { // not highlighted, lexed again when it is reached
+        row->state_gen = 0;
+        syntax_invalidate_from(editor_row_index(row));
+    } else if (update_syntax_from(row, rx)) {
+        syntax_propagate(row, editor_row_index(row));
+    }
+}
+
+void update_row(erow* row) {
+    update_row_from(row, 0);
+}
+
+erow* editor_render_row(erow* row) {
+    if (row->render == NULL) update_render_from(row, 0);
+    return row;
+}
+
+// render and lex a long row from state st up to render column `end`, the
+// window it leaves starting at the char st is in
+void row_lex_window(erow* row, struct hl_state st, int end, int rlen) {
+    int cx = editor_row_rxtocx(row, st.pos);
+    int rs = editor_row_cxtorx(row, cx);
+    row_reserve_render(row, end - rs);
+    if (row->hl == NULL) row->hl = malloc(row->rcap);
+    int n = row_render_span(row, cx, rs, row->render, end - rs);
+    if (ES.lexer) {
+        memset(row->hl, st.prev_hl, st.pos - rs); // the spaces of a tab st is partway through
+        syntax_lex(row, row->render, row->hl, n, rs, st.pos - rs, st, LONG_LINE_CHECKPOINT,
+                   (end == rlen) ? n : n - ES.lexer->reach - 1);
+    } else {
+        memset(row->hl, HL_NORMAL, n);
+    }
+    row->rstart = rs;
+    row->rsize = n;
+}
+
+/* make a long row's render and hl cover render columns [rx, rx + len).
+** the lexer resumes from the last state saved before them, saving more on
+** its way forward, so once the row has been lexed that far a window costs
+** a checkpoint's worth of lexing however far along the row it is */
+void row_window(erow* row, int rx, int len) {
+    if (!(row->flags & ROW_LONG)) return;
+    int rlen = editor_row_cxtorx(row, row->size);
+    if (rx > rlen) rx = rlen;
+    if (len > rlen - rx) len = rlen - rx;
+    if (rx >= row->rstart && rx + len <= row->rstart + row->rsize) return;
+
+    struct syntax_lexer* lx = ES.lexer;
+    struct prof_probe p;
+    PROF_BEGIN(&p);
+    int lo = (rx > LONG_LINE_MARGIN) ? rx - LONG_LINE_MARGIN : 0;
+    int hi = (rlen - rx - len > LONG_LINE_MARGIN) ? rx + len + LONG_LINE_MARGIN : rlen;
+    int look = lx ? lx->reach + lx->kw_maxlen + 1 : 0; // lexed past hi so it reads what it needs to get hi right
+    int end = (rlen - hi > look) ? hi + look : rlen;
+    if (end == rlen) hi = rlen;
+
+    struct hl_state st = { 0, 0, row->hl_start, 0, 1, HL_NORMAL };
+    while (lx) {
+        int k = row->nhlcp;
+        while (k > 0 && row->hlcp[k - 1].pos > lo) k--;
+        if (k > 0) st = row->hlcp[k - 1];
+        if (lo - st.pos <= 2 * LONG_LINE_CHECKPOINT || k < row->nhlcp) break;
+        // lex forward a few checkpoints at a time until one is near
+        int nhlcp = row->nhlcp;
+        int chunk = (rlen - st.pos > 4 * LONG_LINE_CHECKPOINT) ? st.pos + 4 * LONG_LINE_CHECKPOINT : rlen;
+        row_lex_window(row, st, chunk, rlen);
+        if (row->nhlcp == nhlcp) break;
+    }
+    row_lex_window(row, st, end, rlen);
+    row->rsize = hi - row->rstart;
+    PROF_END(&p, PROF_SYNTAX, 1);
+}
+
+// give a mapped row its own copy of chars before it is modified
+void row_own(erow* row) {
+    if (!(row->flags & ROW_MAPPED)) return;
+    char* chars = malloc(row->size + ROW_GAP);
+    memcpy(chars, row->chars, row->size);
+    row->chars = chars;
+    row->gap = row->size;
+    row->gaplen = ROW_GAP;
+    row->flags &= ~ROW_MAPPED;
+}
+
+void row_move_gap(erow* row, int at) {
+    if (at < row->gap) {
+        memmove(&row->chars[at + row->gaplen], &row->chars[at], row->gap - at);
+    } else if (at > row->gap) {
+        memmove(&row->chars[row->gap], &row->chars[row->gap + row->gaplen], at - row->gap);
+    }
+    row->gap = at;
+}
+
+// make the gap at least len bytes, growing chars geometrically
+void row_reserve_gap(erow* row, int len) {
+    if (row->gaplen >= len) return;
+
+    int cap = row->size + row->gaplen;
+    int newcap = cap * 2;
+    if (newcap < row->size + len + ROW_GAP) newcap = row->size + len + ROW_GAP;
+    int tail = row->size - row->gap;
+
+    row->chars = realloc(row->chars, newcap);
+    memmove(&row->chars[newcap - tail], &row->chars[row->gap + row->gaplen], tail);
+    row->gaplen = newcap - row->size;
+}
+
+// close the gap so chars[0..size) is contiguous
+char* row_chars(erow* row) {
+    if (row->flags & ROW_MAPPED) return row->chars;
+    row_move_gap(row, row->size);
+    return row->chars;
+}
+
+// a row holding a copy of s, its render and hl are built when it is drawn
+erow* row_new(const char* s, size_t len) {
+    erow* row = malloc(sizeof(erow));
+
+    row->flags = 0;
+    row->size = len;
+    row->gap = len;
+    row->gaplen = 0;
+    row->chars = malloc(len ? len : 1);
+    memcpy(row->chars, s, len);
+
+    row->rstart = 0;
+    row->rsize = 0;
+    row->rcap = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->hl_gen = 0;
+    row->state_gen = 0;
+    row->hl_start = 0;
+    row->hl_open_comment = 0;
+    row->hlcp = NULL;
+    row->nhlcp = 0;
+    row->tabs = NULL;
+    row->ntabs = 0;
+    row->tabcap = 0;
+    return row;
+}
+
+void editor_insert_row(int at, char* s, size_t len) {
+    if (at < 0 || at > ES.numrows) return;
+
+    undo_insert_row(at, s, len);
+    swap_record(UNDO_INSERT_ROWS, at, 0, s, len);
+    erow* row = row_new(s, len);
+    lt_insert(at, row);
+    update_render_from(row, 0);
+    syntax_invalidate_from(at);
+
+    ES.dirty++;
+}
+
+/* insert the lines of s, each ending in '\n', as rows at `at`, with one
+** splice into the tree, one undo and swap record and one invalidate */
+void editor_insert_rows(int at, const char* s, size_t len) {
+    if (at < 0 || at > ES.numrows) return;
+    const char* end = s + len;
+    const char* p;
+    const char* nl;
+    int n = 0;
+    for (p = s; p < end && (nl = memchr(p, '\n', end - p)) != NULL; p = nl + 1) n++;
+    if (n == 0) return;
+    len = p - s; // a last line without its '\n' isn't one
+
+    undo_insert_rows(at, s, len, n);
+    swap_record(UNDO_INSERT_ROWS, at, n, s, len);
+    erow** rows = malloc(sizeof(erow*) * n);
+    if (rows == NULL) die("malloc");
+    int i;
+    for (i = 0, p = s; i < n; i++, p = nl + 1) {
+        nl = memchr(p, '\n', end - p);
+        rows[i] = row_new(p, nl - p);
+    }
+    lt_splice(at, rows, n);
+    free(rows);
+    syntax_invalidate_from(at);
+    ES.dirty++;
+}
+
+void editor_free_row(erow* row) {
+    free(row->render);
+    if (!(row->flags & ROW_MAPPED)) free(row->chars);
+    free(row->hl);
+    free(row->hlcp);
+    free(row->tabs);
+}
+
+void editor_delete_row(int at) {
+    if (at < 0 || at >= ES.numrows) return;
+    erow* row = editor_row(at);
+    undo_delete_row(at, row_chars(row), row->size);
+    swap_record(UNDO_DELETE_ROWS, at, 0, NULL, 0);
+    lt_remove(at);
+    syntax_invalidate_from(at);
+    editor_free_row(row);
+    if (!(row->flags & ROW_SLAB)) free(row);
+    ES.dirty++;
+}
+
+// delete n rows from `at`, with one splice out of the tree, one swap record
+// and one invalidate. only undo and swap replay delete rows in bulk, so there
+// is no undo record to make
+void editor_delete_rows(int at, int n) {
+    if (at < 0 || at >= ES.numrows || n <= 0) return;
+    if (n > ES.numrows - at) n = ES.numrows - at;
+    erow** rows = malloc(sizeof(erow*) * n);
+    if (rows == NULL) die("malloc");
+    lt_remove_range(at, n, rows);
+
+    int i;
+    swap_record(UNDO_DELETE_ROWS, at, n, NULL, 0);
+    syntax_invalidate_from(at);
+    for (i = 0; i < n; i++) {
+        editor_free_row(rows[i]);
+        if (!(rows[i]->flags & ROW_SLAB)) free(rows[i]);
+    }
+    free(rows);
+    ES.dirty++;
+}
+
+void row_insert_string(erow* row, int at, const char* s, size_t len) {
+    if (at < 0 || at > row->size) at = row->size;
+    undo_insert_chars(row, at, s, len);
+    swap_record(UNDO_INSERT_CHARS, editor_row_index(row), at, s, len);
+    row_own(row);
+    row_move_gap(row, at);
+    row_reserve_gap(row, len);
+    memcpy(&row->chars[row->gap], s, len);
+    row->gap += len;
+    row->gaplen -= len;
+    row->size += len;
+    update_row_from(row, at);
+    ES.dirty++;
+}
+
+void row_delete_range(erow* row, int at, int len) {
+    if (at < 0 || at >= row->size) return;
+    if (len > row->size - at) len = row->size - at;
+    row_own(row);
+    row_move_gap(row, at);
+    undo_delete_chars(row, at, &row->chars[row->gap + row->gaplen], len);
+    swap_record(UNDO_DELETE_CHARS, editor_row_index(row), at, NULL, len);
+    row->gaplen += len;
+    row->size -= len;
+    update_row_from(row, at);
+    ES.dirty++;
+}
+
+void row_insert_char(erow* row, int at, int c) {
+    char ch = c;
+    row_insert_string(row, at, &ch, 1);
+}
+
+void row_append_string(erow* row, char* s, size_t len) {
+    row_insert_string(row, row->size, s, len);
+}
+
+void row_delete_char(erow* row, int at) {
+    row_delete_range(row, at, 1);
+}
+
+/* rebuild a row with the spans from p on that are in it replaced, forward
+** puts `with` where each span's text was and backward puts the text back.
+** returns where the next row's spans start, or NULL if they don't fit */
+const char* row_replace_spans(erow* row, int y, const char* with, int wlen, const char* p, const char* end, int forward) {
+    const char* old = row_chars(row);
+    struct find_match span;
+    const char* q;
+    int size = row->size;
+    int at = 0, delta = 0;
+    for (q = p; q + sizeof(span) <= end; q += sizeof(span) + span.len) {
+        memcpy(&span, q, sizeof(span));
+        if (span.y != y) break;
+        int x = forward ? span.x : span.x + delta; // where the span is now
+        int cut = forward ? span.len : wlen;
+        if (span.len < 0 || x < at || x + cut > row->size || span.len > end - q - (int)sizeof(span)) return NULL;
+        at = x + cut;
+        delta += wlen - span.len;
+        size += forward ? wlen - span.len : span.len - wlen;
+    }
+    const char* next = q;
+
+    char* chars = malloc(size + ROW_GAP);
+    int from = 0, to = 0;
+    delta = 0;
+    for (q = p; q < next; q += sizeof(span) + span.len) {
+        memcpy(&span, q, sizeof(span));
+        int x = forward ? span.x : span.x + delta;
+        memcpy(&chars[to], &old[from], x - from);
+        to += x - from;
+        if (forward) {
+            memcpy(&chars[to], with, wlen);
+            to += wlen;
+            from = x + span.len;
+        } else {
+            memcpy(&chars[to], q + sizeof(span), span.len);
+            to += span.len;
+            from = x + wlen;
+        }
+        delta += wlen - span.len;
+    }
+    memcpy(&chars[to], &old[from], row->size - from);
+
+    if (forward) undo_replace(y, with, wlen, p, next - p); // backward only happens while undoing
+    swap_record_parts(UNDO_REPLACE, y, wlen << 1 | forward, with, wlen, p, next - p);
+
+    if (!(row->flags & ROW_MAPPED)) free(row->chars);
+    row->flags &= ~ROW_MAPPED;
+    row->chars = chars;
+    row->size = size;
+    row->gap = size;
+    row->gaplen = ROW_GAP;
+
+    // render and hl are rebuilt when the row is next drawn
+    free(row->render);
+    free(row->hl);
+    row->render = NULL;
+    row->hl = NULL;
+    row->rsize = 0;
+    row->rcap = 0;
+    row->nhlcp = 0;
+    row->hl_gen = 0;
+    row->state_gen = 0;
+    syntax_invalidate_from(y);
+    ES.dirty++;
+    return next;
+}
+
+/* editor operations */
+void editor_insert_char(int c) {
+    if (ES.cy == ES.numrows) { editor_insert_row(ES.numrows, "", 0); }
+    row_insert_char(editor_row(ES.cy), ES.cx, c);
+    ES.cx++;
+}
+
+void editor_insert_newline() {
+    if (ES.cx == 0) {
+        editor_insert_row(ES.cy, "", 0);
+    } else {
+        erow* row = editor_row(ES.cy);
+        editor_insert_row(ES.cy + 1, &row_chars(row)[ES.cx], row->size - ES.cx);
+        row_delete_range(row, ES.cx, row->size - ES.cx);
+    }
+    ES.cy++;
+    ES.cx = 0;
+}
+
+void editor_delete_char() {
+    if (ES.cy == ES.numrows) return;
+    if (ES.cx == 0 && ES.cy == 0) return;
+
+    erow* row = editor_row(ES.cy);
+    if (ES.cx > 0) {
+        row_delete_char(row, ES.cx - 1);
+        ES.cx--;
+    } else {
+        erow* prev = editor_row(ES.cy - 1);
+        ES.cx = prev->size;
+        row_append_string(prev, row_chars(row), row->size);
+        editor_delete_row(ES.cy);
+        ES.cy--;
+    }
+}
+
+// insert text that may span lines at the cursor, leaving the cursor after it
+void editor_insert_text(const char* s, int len) {
+    if (len == 0) return;
+    if (ES.cy == ES.numrows) editor_insert_row(ES.numrows, "", 0);
+
+    erow* row = editor_row(ES.cy);
+    const char* nl = memchr(s, '\n', len);
+    if (nl == NULL) {
+        row_insert_string(row, ES.cx, s, len);
+        ES.cx += len;
+        return;
+    }
+
+    // the lines after the first, with the rest of the cursor's line after
+    // the last of them, go in as one block of rows
+    const char* end = s + len;
+    const char* last = nl + 1;
+    int n = 0;
+    const char* p;
+    for (p = s; (p = memchr(p, '\n', end - p)) != NULL; last = ++p) n++;
+    int taillen = row->size - ES.cx;
+    size_t restlen = end - (nl + 1);
+    char* rest = malloc(restlen + taillen + 1);
+    if (rest == NULL) die("malloc");
+    memcpy(rest, nl + 1, restlen);
+    memcpy(rest + restlen, &row_chars(row)[ES.cx], taillen);
+    rest[restlen + taillen] = '\n';
+
+    if (taillen) row_delete_range(row, ES.cx, taillen);
+    if (nl > s) row_insert_string(row, ES.cx, s, nl - s);
+    editor_insert_rows(ES.cy + 1, rest, restlen + taillen + 1);
+    free(rest);
+
+    ES.cy += n;
+    ES.cx = end - last;
+}
+
+void editor_paste() {
+    int len;
+    char* text = read_paste(&len);
+    editor_insert_text(text, len);
+    free(text);
+}
+
+void undo_apply(struct undo_record* rec, int inverse) {
+    int insert = (rec->type == UNDO_INSERT_CHARS || rec->type == UNDO_INSERT_ROWS) != inverse;
+    switch (rec->type) {
+        case UNDO_INSERT_CHARS:
+        case UNDO_DELETE_CHARS:
+            if (insert) row_insert_string(editor_row(rec->y), rec->x, undo_text(rec), rec->len);
+            else row_delete_range(editor_row(rec->y), rec->x, rec->len);
+            break;
+        case UNDO_INSERT_ROWS:
+        case UNDO_DELETE_ROWS:
+            if (insert) editor_insert_rows(rec->y, undo_text(rec), rec->len);
+            else editor_delete_rows(rec->y, rec->n);
+            break;
+        case UNDO_REPLACE:
+            {
+                const char* with = undo_text(rec);
+                const char* p = with + rec->x;
+                const char* end = with + rec->len;
+                struct find_match span;
+                while (p && p < end) {
+                    memcpy(&span, p, sizeof(span));
+                    p = row_replace_spans(editor_row(span.y), span.y, with, rec->x, p, end, !inverse);
+                }
+            }
+            break;
+    }
+}
+
+// keep the cursor on the buffer whatever the records it came from say
+void editor_clamp_cursor() {
+    if (ES.cy > ES.numrows) ES.cy = ES.numrows;
+    if (ES.cy < 0) ES.cy = 0;
+    erow* row = editor_row(ES.cy);
+    int rowlen = row ? row->size : 0;
+    if (ES.cx > rowlen) ES.cx = rowlen;
+    if (ES.cx < 0) ES.cx = 0;
+}
+
+void editor_undo() {
+    if (ES.undo.cur == 0) {
+        editor_set_statusmessage("already at oldest change");
+        return;
+    }
+    ES.undo.suspended++;
+    int group = undo_at(ES.undo.cur - 1)->group;
+    struct undo_record* applied = NULL; // the command's first record, it holds the cursor before it
+    while (ES.undo.cur > 0 && undo_at(ES.undo.cur - 1)->group == group) {
+        applied = undo_at(ES.undo.cur - 1);
+        undo_apply(applied, 1);
+        ES.undo.cur--;
+    }
+    ES.cx = applied->cx;
+    ES.cy = applied->cy;
+    editor_clamp_cursor();
+    ES.undo.suspended--;
+}
+
+void editor_redo() {
+    if (ES.undo.cur == ES.undo.nrecs) {
+        editor_set_statusmessage("already at newest change");
+        return;
+    }
+    ES.undo.suspended++;
+    int group = undo_at(ES.undo.cur)->group;
+    struct undo_record* applied = NULL; // the command's last record, it holds the cursor after it
+    while (ES.undo.cur < ES.undo.nrecs && undo_at(ES.undo.cur)->group == group) {
+        applied = undo_at(ES.undo.cur);
+        undo_apply(applied, 0);
+        ES.undo.cur++;
+    }
+    ES.cx = applied->cx_after;
+    ES.cy = applied->cy_after;
+    editor_clamp_cursor();
+    ES.undo.suspended--;
+}
+
+/* workers */
+/* a pool of threads, started the first time it is asked for. a job runs on
+** every worker and the calling thread at once, and they split the work
+** between them, usually by claiming chunks from a shared counter */
+#define POOL_MAX_THREADS 64
+
+void* pool_worker(void* arg) {
+    struct pool* pool = arg;
+    int gen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->gen == gen) pthread_cond_wait(&pool->work, &pool->lock);
+        gen = pool->gen;
+        void (*job)(void*) = pool->job;
+        void* job_arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        job(job_arg);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+    }
+    return NULL;
+}
+
+// threads a job runs on, counting the caller
+int pool_threads() {
+    struct pool* pool = &ES.pool;
+    if (pool->threads) return pool->nthreads + 1;
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > POOL_MAX_THREADS) n = POOL_MAX_THREADS;
+    pool->threads = malloc(sizeof(pthread_t) * n);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // signals are left to the main thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int i;
+    for (i = 0; i < n - 1; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0) break;
+    }
+    pool->nthreads = i;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return pool->nthreads + 1;
+}
+
+// run job(arg) on every thread and wait for them all to return
+void pool_run(void (*job)(void*), void* arg) {
+    struct pool* pool = &ES.pool;
+    if (pool_threads() > 1) {
+        pthread_mutex_lock(&pool->lock);
+        pool->job = job;
+        pool->arg = arg;
+        pool->busy = pool->nthreads;
+        pool->gen++;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    job(arg);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* file i/o */
+
+// write all of iov, picking up after partial writes
+int writev_all(int fd, struct iovec* iov, int n) {
+    while (n > 0) {
+        ssize_t written = writev(fd, iov, n);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (n > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+int swap_get_varint(const char** p, const char* end, unsigned long* v) {
+    int shift = 0;
+    *v = 0;
+    while (*p < end && shift < 64) {
+        unsigned char b = *(*p)++;
+        *v |= (unsigned long)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return 0;
+        shift += 7;
+    }
+    return -1;
+}
+
+/* apply the records in a swap. stops at a record cut short by the crash,
+** or one that doesn't fit the file, and sets *stop to where it did */
+int swap_replay(const char* p, const char* end, const char** stop) {
+    int applied = 0;
+    *stop = p;
+    while (p < end) {
+        int type = *p++;
+        unsigned long y, x, len;
+        if (swap_get_varint(&p, end, &y) == -1) break;
+        if (swap_get_varint(&p, end, &x) == -1) break;
+        if (swap_get_varint(&p, end, &len) == -1) break;
+
+        int text = (type == UNDO_INSERT_CHARS || type == UNDO_INSERT_ROWS || type == UNDO_REPLACE);
+        if (text && len > (unsigned long)(end - p)) break;
+        if (y > (unsigned long)ES.numrows || (type != UNDO_INSERT_ROWS && y == (unsigned long)ES.numrows)) break;
+
+        switch (type) {
+            case UNDO_INSERT_CHARS:
+                row_insert_string(editor_row(y), x, p, len);
+                break;
+            case UNDO_DELETE_CHARS:
+                row_delete_range(editor_row(y), x, len);
+                break;
+            case UNDO_INSERT_ROWS: // x rows as lines, or one row when 0
+                if (x && (len == 0 || p[len - 1] != '\n')) return applied;
+                if (x) editor_insert_rows(y, p, len);
+                else editor_insert_row(y, (char*)p, len);
+                break;
+            case UNDO_DELETE_ROWS:
+                if (x > (unsigned long)ES.numrows - y) return applied;
+                if (x) editor_delete_rows(y, x);
+                else editor_delete_row(y);
+                break;
+            case UNDO_REPLACE: // x is the replacement's length, shifted left once over the direction
+                if ((x >> 1) > len) return applied;
+                if (row_replace_spans(editor_row(y), y, p, x >> 1, p + (x >> 1), p + len, x & 1) != p + len) return applied;
+                break;
+            default:
+                return applied;
+        }
+        if (text) p += len;
+        *stop = p;
+        applied++;
+    }
+    return applied;
+}
+
+// offer to replay a swap left behind for the file just opened, then keep journaling
+void swap_recover() {
+    char* name = swap_name(ES.filename);
+    int fd = open(name, O_RDONLY);
+    struct stat st, fst;
+    struct swap_header h;
+
+    if (fd != -1 && fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(h) &&
+        read(fd, &h, sizeof(h)) == sizeof(h) && !memcmp(h.magic, SWAP_MAGIC, 8) &&
+        stat(ES.filename, &fst) == 0) {
+        int stale = (h.size != fst.st_size || h.mtime != fst.st_mtime);
+        editor_set_statusmessage("%s has unsaved changes%s, recover them? (y/n)", name,
+                                 stale ? " to an older version of the file" : "");
+        refresh_screen();
+
+        int c;
+        do c = read_key(); while (c != 'y' && c != 'n' && c != '\x1b');
+
+        size_t len = st.st_size - sizeof(h);
+        char* buf = (c == 'y') ? malloc(len) : NULL;
+        if (buf && read(fd, buf, len) == (ssize_t)len) {
+            const char* stop;
+            ES.undo.suspended++;
+            int n = swap_replay(buf, buf + len, &stop);
+            ES.undo.suspended--;
+            if (n) ES.dirty = 1;
+            editor_set_statusmessage("recovered %d changes from %s", n, name);
+
+            // carry on appending to it, after the last record that applied
+            if (truncate(name, sizeof(h) + (stop - buf)) == 0) {
+                ES.swap.fd = open(name, O_WRONLY | O_APPEND);
+                free(ES.swap.name);
+                ES.swap.name = name;
+                name = NULL;
+            }
+        } else if (c == 'y') {
+            editor_set_statusmessage("could not read %s", name);
+        } else {
+            editor_set_statusmessage("");
+        }
+        free(buf);
+    }
+    if (fd != -1) close(fd);
+    free(name);
+
+    if (ES.swap.fd == -1) swap_start();
+}
+
+/* a file's rows point straight into it. its newlines are found in slices
+** that workers claim, each slice keeping the offsets of its own, then the
+** slices are stitched together, the rows are allocated in one slab and
+** filled in parallel, and the tree is built over them bottom up */
+#define LOAD_SLICE_MIN (1 << 22) // bytes, files under two slices are indexed by the calling thread alone
+#define LOAD_SLICE_MAX (1 << 30) // so offsets within a slice fit in an unsigned int
+#define LOAD_BLOCK (1 << 16) // bytes scanned between checks that the offsets have room
+#define READ_BLOCK (1 << 24) // bytes read at a time from a file that can't be mapped
+
+typedef size_t (*newline_fn)(const char* s, size_t n, unsigned int base, unsigned int* out);
+newline_fn load_newlines = NULL;
+
+struct load_slice {
+    size_t start, len; // where the slice is in the file
+    unsigned int* nl; // offsets of its newlines from start
+    size_t n, cap;
+    size_t row; // the row its first newline ends
+    size_t from; // and where that row starts
+};
+
+struct load_job {
+    const char* text;
+    struct load_slice* slices;
+    int nslices;
+    erow* rows;
+    int next; // first slice not yet claimed
+};
+
+// store the offset of every newline in s, plus base, and return how many there were
+size_t load_newlines_scalar(const char* s, size_t n, unsigned int base, unsigned int* out) {
+    const char* p = s;
+    const char* end = s + n;
+    size_t k = 0;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        out[k++] = base + (p - s);
+        p++;
+    }
+    return k;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+size_t load_newlines_sse2(const char* s, size_t n, unsigned int base, unsigned int* out) {
+    __m128i nl = _mm_set1_epi8('\n');
+    size_t i, k = 0;
+    for (i = 0; i + 16 <= n; i += 16) {
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i)), nl));
+        while (mask) {
+            out[k++] = base + i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return k + load_newlines_scalar(s + i, n - i, base + i, out + k);
+}
+
+__attribute__((target("avx2")))
+size_t load_newlines_avx2(const char* s, size_t n, unsigned int base, unsigned int* out) {
+    __m256i nl = _mm256_set1_epi8('\n');
+    size_t i, k = 0;
+    for (i = 0; i + 32 <= n; i += 32) {
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + i)), nl));
+        while (mask) {
+            out[k++] = base + i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return k + load_newlines_sse2(s + i, n - i, base + i, out + k);
+}
+#endif
+
+void load_select() {
+    load_newlines = load_newlines_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) load_newlines = load_newlines_sse2;
+    if (__builtin_cpu_supports("avx2")) load_newlines = load_newlines_avx2;
+#endif
+}
+
+void load_index(void* arg) {
+    struct load_job* job = arg;
+    int i;
+    while ((i = __sync_fetch_and_add(&job->next, 1)) < job->nslices) {
+        struct load_slice* sl = &job->slices[i];
+        size_t at;
+        for (at = 0; at < sl->len; at += LOAD_BLOCK) {
+            size_t len = (sl->len - at < LOAD_BLOCK) ? sl->len - at : LOAD_BLOCK;
+            if (sl->n + len > sl->cap) { // room for a block of nothing but newlines
+                sl->cap = (sl->cap * 2 > sl->n + len) ? sl->cap * 2 : sl->n + len;
+                sl->nl = realloc(sl->nl, sizeof(unsigned int) * sl->cap);
+                if (sl->nl == NULL) die("realloc");
+            }
+            sl->n += load_newlines(job->text + sl->start + at, len, at, sl->nl + sl->n);
+        }
+    }
+}
+
+void load_row(erow* row, const char* p, size_t len) {
+    while (len > 0 && p[len - 1] == '\r') len--;
+    row->flags = ROW_MAPPED | ROW_SLAB;
+    row->chars = (char*)p;
+    row->size = len;
+    row->gap = len;
+}
+
+void load_fill(void* arg) {
+    struct load_job* job = arg;
+    int i;
+    while ((i = __sync_fetch_and_add(&job->next, 1)) < job->nslices) {
+        struct load_slice* sl = &job->slices[i];
+        size_t from = sl->from;
+        size_t k;
+        for (k = 0; k < sl->n; k++) {
+            size_t nl = sl->start + sl->nl[k];
+            load_row(&job->rows[sl->row + k], job->text + from, nl - from);
+            from = nl + 1;
+        }
+        free(sl->nl);
+    }
+}
+
+// make the rows of a file held in text, which must stay alive as long as they do
+void editor_load(const char* text, size_t len) {
+    if (load_newlines == NULL) load_select();
+
+    int nslices = 1;
+    if (len >= 2 * LOAD_SLICE_MIN) nslices = pool_threads() * 4;
+    size_t slice = (len + nslices - 1) / nslices;
+    if (slice < LOAD_SLICE_MIN) slice = LOAD_SLICE_MIN;
+    if (slice > LOAD_SLICE_MAX) slice = LOAD_SLICE_MAX;
+    nslices = len ? (len + slice - 1) / slice : 1;
+
+    struct load_job job = { text, calloc(nslices, sizeof(struct load_slice)), nslices, NULL, 0 };
+    int i;
+    for (i = 0; i < nslices; i++) {
+        job.slices[i].start = slice * i;
+        job.slices[i].len = (i == nslices - 1) ? len - slice * i : slice;
+    }
+    if (nslices > 1) {
+        pool_run(load_index, &job);
+    } else {
+        load_index(&job);
+    }
+
+    // every newline ends a row, and text after the last one is a row too
+    size_t nrows = 0, from = 0;
+    for (i = 0; i < nslices; i++) {
+        struct load_slice* sl = &job.slices[i];
+        sl->row = nrows;
+        sl->from = from;
+        nrows += sl->n;
+        if (sl->n) from = sl->start + sl->nl[sl->n - 1] + 1;
+    }
+    int last = from < len;
+    if (nrows + last > INT_MAX) die("too many lines");
+
+    job.rows = calloc(nrows + last ? nrows + last : 1, sizeof(erow));
+    if (job.rows == NULL) die("calloc");
+    job.next = 0;
+    if (nslices > 1) {
+        pool_run(load_fill, &job);
+    } else {
+        load_fill(&job);
+    }
+    if (last) load_row(&job.rows[nrows], text + from, len - from);
+    free(job.slices);
+
+    if (nrows + last) {
+        lt_build(job.rows, nrows + last);
+    } else {
+        free(job.rows);
+    }
+    ES.map = (char*)text;
+    ES.maplen = len;
+}
+
+int editor_open_mapped(char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    editor_load(map, st.st_size);
+    return 0;
+}
+
+// read fd to its end in big blocks, returning NULL for nothing
+char* read_all(int fd, size_t* size) {
+    size_t len = 0, cap = READ_BLOCK;
+    char* text = malloc(cap);
+    ssize_t n;
+    while (text && (n = read(fd, text + len, cap - len)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            die("read");
+        }
+        len += n;
+        if (len == cap) text = realloc(text, cap *= 2);
+    }
+    if (text == NULL) die("realloc");
+    if (len == 0) {
+        free(text);
+        text = NULL;
+    } else {
+        char* fit = realloc(text, len);
+        if (fit) text = fit;
+    }
+    *size = len;
+    return text;
+}
+
+// files that can't be mapped, like pipes, are read whole instead
+void editor_open_read(char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) die("open");
+    size_t len;
+    char* text = read_all(fd, &len);
+    close(fd);
+    editor_load(text, len);
+}
+
+void editor_open(char* filename) {
+    free(ES.filename);
+    ES.filename = strdup(filename);
+
+    select_syntax_highlight();
+
+    if (editor_open_mapped(filename) == -1) editor_open_read(filename);
+    ES.dirty = 0;
+    swap_recover();
+}
+
+// write every row to fd, gathering them straight from their chars
+int write_rows(int fd, size_t* len) {
+    struct iovec iov[SAVE_IOV];
+    int n = 0;
+    struct row_iter it;
+    erow* row;
+
+    *len = 0;
+    for (row = row_iter_seek(&it, 0); row; row = row_iter_next(&it)) {
+        if (n + 3 > SAVE_IOV) {
+            if (writev_all(fd, iov, n) == -1) return -1;
+            n = 0;
+        }
+        // the two sides of the gap, then the line ending
+        if (row->gap) {
+            iov[n].iov_base = row->chars;
+            iov[n++].iov_len = row->gap;
+        }
+        if (row->size > row->gap) {
+            iov[n].iov_base = &row->chars[row->gap + row->gaplen];
+            iov[n++].iov_len = row->size - row->gap;
+        }
+        iov[n].iov_base = "\n";
+        iov[n++].iov_len = 1;
+        *len += row->size + 1;
+    }
+    return writev_all(fd, iov, n);
+}
+
+// write the rows to a temporary file beside path and rename it over path.
+// st is path's old stat, or NULL if it's new. returns 0, -1 with errno set,
+// or 1 if the temporary file couldn't be given st's owner. mapped rows
+// keep pointing into the old file, which the mapping keeps alive
+int save_renamed(const char* path, const struct stat* st, size_t* len) {
+    const char* slash = strrchr(path, '/');
+    int dirlen = slash ? slash - path + 1 : 0;
+    char* tmpname = malloc(dirlen + sizeof(".inn-XXXXXX"));
+    if (tmpname == NULL) die("malloc");
+    memcpy(tmpname, path, dirlen);
+    strcpy(&tmpname[dirlen], ".inn-XXXXXX");
+
+    int fd = mkstemp(tmpname);
+    if (fd == -1) {
+        free(tmpname);
+        return -1;
+    }
+    if (st && fchown(fd, st->st_uid, st->st_gid) == -1) {
+        close(fd);
+        unlink(tmpname);
+        free(tmpname);
+        return 1;
+    }
+    int ok = fchmod(fd, st ? (st->st_mode & 07777) : 0644) != -1 &&
+             write_rows(fd, len) != -1 &&
+             fsync(fd) != -1;
+    int err = errno;
+    if (close(fd) == -1 && ok) {
+        ok = 0;
+        err = errno;
+    }
+    if (ok && rename(tmpname, path) == -1) {
+        ok = 0;
+        err = errno;
+    }
+    if (!ok) {
+        unlink(tmpname);
+        free(tmpname);
+        errno = err;
+        return -1;
+    }
+
+    strcpy(&tmpname[dirlen], "."); // the directory, so the rename is durable too
+    int dirfd = open(tmpname, O_RDONLY | O_DIRECTORY);
+    if (dirfd != -1) {
+        fsync(dirfd);
+        close(dirfd);
+    }
+    free(tmpname);
+    return 0;
+}
+
+// write the rows over path itself, keeping its inode. returns 0 or -1
+// with errno set
+int save_in_place(const char* path, size_t* len) {
+    struct row_iter it;
+    erow* row;
+    for (row = row_iter_seek(&it, 0); row; row = row_iter_next(&it)) {
+        row_own(row); // the file is rewritten under the mapping
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd == -1) return -1;
+    int ok = write_rows(fd, len) != -1 &&
+             ftruncate(fd, *len) != -1 &&
+             fsync(fd) != -1;
+    int err = errno;
+    if (close(fd) == -1 && ok) {
+        ok = 0;
+        err = errno;
+    }
+    errno = err;
+    return ok ? 0 : -1;
+}
+
+void editor_save() {
+    if (ES.filename == NULL) {
+        ES.filename = editor_prompt("save as: %s (ESC to cancel)", NULL, 0);
+        if (ES.filename == NULL) {
+            editor_set_statusmessage("save aborted");
+            return;
+        }
+        select_syntax_highlight();
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* write a temporary file next to the original and rename it over, so the
+    ** file is never half written. the name is resolved first so a symlink
+    ** stays one. a file with other hard links, or whose owner the temporary
+    ** file can't be given, is rewritten in place as the rename would split
+    ** it from them */
+    char* path = realpath(ES.filename, NULL);
+    if (path == NULL) path = strdup(ES.filename); // a new file
+    struct stat st;
+    int exists = lstat(path, &st) == 0;
+    size_t len = 0;
+    int status = (exists && st.st_nlink > 1) ? 1 : save_renamed(path, exists ? &st : NULL, &len);
+    if (status == 1) status = save_in_place(path, &len);
+    int err = errno;
+    free(path);
+    if (status == -1) {
+        editor_set_statusmessage("save failed. I/O error: %s", strerror(err));
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    ES.dirty = 0;
+    swap_stop();
+    swap_start(); // edits are now relative to what was just written
+    editor_set_statusmessage("%zu bytes written to disk in %.0fms (%.1f MB/s)",
+                             len, ms, ms > 0 ? len / ms / 1e3 : 0.0);
+}
+
+/* regex */
+/* patterns are parsed into a tree, compiled to a thompson nfa program and
+** run as a dfa whose states are built the first time they are reached.
+** the pattern is also compiled backwards, so a row takes one pass forward
+** to find whether a match ends, one back from the end of the row to mark
+** where matches can start and one sweep forward for where they end.
+** rows are matched as bytes; ^ and $ are the ends of the row.
+** supported: literals, ., [classes], \d \w \s and their negations, ( ), |,
+** * + ? */
+enum regex_op {
+    RE_SET, // consume a byte in class x
+    RE_SPLIT, // continue at both x and y
+    RE_JMP,
+    RE_BOL,
+    RE_EOL,
+    RE_MATCH
+};
+
+enum regex_node_type {
+    RN_SET,
+    RN_BOL,
+    RN_EOL,
+    RN_EMPTY,
+    RN_CAT,
+    RN_ALT,
+    RN_STAR,
+    RN_PLUS,
+    RN_QUEST
+};
+
+struct regex_node {
+    int type;
+    int left, right;
+    int cls;
+    int literal; // the one byte a set matches, or -1
+};
+
+struct regex_parser {
+    const char* p;
+    const char* end;
+    struct regex* re;
+    struct regex_node* nodes;
+    int nnodes, cap;
+    int error;
+};
+
+#define RE_MAX_STATES 2048 // dfa states cached before the cache is thrown away
+
+int regex_node(struct regex_parser* ps, int type, int left, int right) {
+    if (ps->nnodes == ps->cap) {
+        ps->cap = ps->cap ? ps->cap * 2 : 64;
+        ps->nodes = realloc(ps->nodes, sizeof(struct regex_node) * ps->cap);
+        if (ps->nodes == NULL) die("realloc");
+    }
+    struct regex_node* n = &ps->nodes[ps->nnodes];
+    n->type = type;
+    n->left = left;
+    n->right = right;
+    n->cls = -1;
+    n->literal = -1;
+    return ps->nnodes++;
+}
+
+int regex_class(struct regex* re) {
+    re->classes = realloc(re->classes, sizeof(re->classes[0]) * (re->nclasses + 1));
+    if (re->classes == NULL) die("realloc");
+    memset(re->classes[re->nclasses], 0, sizeof(re->classes[0]));
+    return re->nclasses++;
+}
+
+void regex_class_add(unsigned char* cls, int c) {
+    cls[c >> 3] |= 1 << (c & 7);
+}
+
+int regex_class_has(const unsigned char* cls, int c) {
+    return cls[c >> 3] & (1 << (c & 7));
+}
+
+// \d \w \s and friends into cls, returns 0 if c isn't one
+int regex_class_escape(unsigned char* cls, int c) {
+    int lower = tolower(c);
+    if (lower != 'd' && lower != 'w' && lower != 's') return 0;
+    int j;
+    for (j = 0; j < 256; j++) {
+        int in = (lower == 'd') ? isdigit(j) : (lower == 'w') ? (isalnum(j) || j == '_') : isspace(j);
+        if ((c == lower) ? in : !in) regex_class_add(cls, j); // \D \W \S are the complement
+    }
+    return 1;
+}
+
+int regex_escaped(int c) {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+    }
+    return c;
+}
+
+int regex_parse_alt(struct regex_parser* ps);
+
+int regex_parse_class(struct regex_parser* ps) {
+    int cls = regex_class(ps->re);
+    unsigned char set[32] = { 0 };
+    int negate = 0;
+    if (ps->p < ps->end && *ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+    int first = 1;
+    while (ps->p < ps->end && (*ps->p != ']' || first)) {
+        int c = (unsigned char)*ps->p++;
+        first = 0;
+        if (c == '\\' && ps->p < ps->end) {
+            c = (unsigned char)*ps->p++;
+            if (regex_class_escape(set, c)) continue;
+            c = regex_escaped(c);
+        }
+        int hi = c;
+        if (ps->p + 1 < ps->end && ps->p[0] == '-' && ps->p[1] != ']') {
+            hi = (unsigned char)ps->p[1];
+            ps->p += 2;
+            if (hi == '\\' && ps->p < ps->end) hi = regex_escaped((unsigned char)*ps->p++);
+        }
+        for (; c <= hi; c++) regex_class_add(set, c);
+    }
+    if (ps->p == ps->end) {
+        ps->error = 1;
+        return regex_node(ps, RN_EMPTY, -1, -1);
+    }
+    ps->p++; // ]
+    int j;
+    for (j = 0; j < 32; j++) ps->re->classes[cls][j] = negate ? ~set[j] : set[j];
+    int n = regex_node(ps, RN_SET, -1, -1);
+    ps->nodes[n].cls = cls;
+    return n;
+}
+
+int regex_parse_atom(struct regex_parser* ps) {
+    int c = (unsigned char)*ps->p++;
+    int n, cls;
+    switch (c) {
+        case '(':
+            n = regex_parse_alt(ps);
+            if (ps->p == ps->end || *ps->p != ')') ps->error = 1;
+            else ps->p++;
+            return n;
+        case '[':
+            return regex_parse_class(ps);
+        case '^':
+            return regex_node(ps, RN_BOL, -1, -1);
+        case '$':
+            return regex_node(ps, RN_EOL, -1, -1);
+        case '*':
+        case '+':
+        case '?':
+            ps->error = 1; // nothing to repeat
+            return regex_node(ps, RN_EMPTY, -1, -1);
+    }
+
+    cls = regex_class(ps->re);
+    n = regex_node(ps, RN_SET, -1, -1);
+    ps->nodes[n].cls = cls;
+    if (c == '.') {
+        memset(ps->re->classes[cls], 0xff, sizeof(ps->re->classes[cls]));
+        return n;
+    }
+    if (c == '\\') {
+        if (ps->p == ps->end) {
+            ps->error = 1;
+            return n;
+        }
+        c = (unsigned char)*ps->p++;
+        if (regex_class_escape(ps->re->classes[cls], c)) return n;
+        c = regex_escaped(c);
+    }
+    regex_class_add(ps->re->classes[cls], c);
+    ps->nodes[n].literal = c;
+    return n;
+}
+
+int regex_parse_repeat(struct regex_parser* ps) {
+    int n = regex_parse_atom(ps);
+    while (ps->p < ps->end && strchr("*+?", *ps->p)) {
+        char c = *ps->p++;
+        n = regex_node(ps, c == '*' ? RN_STAR : c == '+' ? RN_PLUS : RN_QUEST, n, -1);
+    }
+    return n;
+}
+
+int regex_parse_cat(struct regex_parser* ps) {
+    int n = -1;
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+        int atom = regex_parse_repeat(ps);
+        n = (n == -1) ? atom : regex_node(ps, RN_CAT, n, atom);
+    }
+    return (n == -1) ? regex_node(ps, RN_EMPTY, -1, -1) : n;
+}
+
+int regex_parse_alt(struct regex_parser* ps) {
+    int n = regex_parse_cat(ps);
+    while (ps->p < ps->end && *ps->p == '|') {
+        ps->p++;
+        n = regex_node(ps, RN_ALT, n, regex_parse_cat(ps));
+    }
+    return n;
+}
+
+int regex_emit(struct regex* re, int op, int x, int y) {
+    if ((re->nprog & (re->nprog - 1)) == 0) { // grow at powers of two
+        re->prog = realloc(re->prog, sizeof(struct regex_inst) * (re->nprog ? re->nprog * 2 : 1));
+        if (re->prog == NULL) die("realloc");
+    }
+    re->prog[re->nprog].op = op;
+    re->prog[re->nprog].x = x;
+    re->prog[re->nprog].y = y;
+    return re->nprog++;
+}
+
+void regex_compile_node(struct regex* re, struct regex_node* nodes, int i) {
+    struct regex_node* n = &nodes[i];
+    int split, jmp, loop;
+    switch (n->type) {
+        case RN_SET: regex_emit(re, RE_SET, n->cls, 0); break;
+        case RN_BOL: regex_emit(re, re->reversed ? RE_EOL : RE_BOL, 0, 0); break; // read backwards, a row starts at its end
+        case RN_EOL: regex_emit(re, re->reversed ? RE_BOL : RE_EOL, 0, 0); break;
+        case RN_EMPTY: break;
+        case RN_CAT:
+            regex_compile_node(re, nodes, re->reversed ? n->right : n->left);
+            regex_compile_node(re, nodes, re->reversed ? n->left : n->right);
+            break;
+        case RN_ALT:
+            split = regex_emit(re, RE_SPLIT, 0, 0);
+            re->prog[split].x = re->nprog;
+            regex_compile_node(re, nodes, n->left);
+            jmp = regex_emit(re, RE_JMP, 0, 0);
+            re->prog[split].y = re->nprog;
+            regex_compile_node(re, nodes, n->right);
+            re->prog[jmp].x = re->nprog;
+            break;
+        case RN_QUEST:
+            split = regex_emit(re, RE_SPLIT, 0, 0);
+            re->prog[split].x = re->nprog;
+            regex_compile_node(re, nodes, n->left);
+            re->prog[split].y = re->nprog;
+            break;
+        case RN_STAR:
+            split = regex_emit(re, RE_SPLIT, 0, 0);
+            re->prog[split].x = re->nprog;
+            regex_compile_node(re, nodes, n->left);
+            regex_emit(re, RE_JMP, split, 0);
+            re->prog[split].y = re->nprog;
+            break;
+        case RN_PLUS:
+            loop = re->nprog;
+            regex_compile_node(re, nodes, n->left);
+            regex_emit(re, RE_SPLIT, loop, re->nprog + 1);
+            break;
+    }
+}
+
+// append the literal text every match starts with, returns whether all of node i was literal
+int regex_literal_prefix(struct regex* re, struct regex_node* nodes, int i) {
+    struct regex_node* n = &nodes[i];
+    switch (n->type) {
+        case RN_SET:
+            if (n->literal == -1) return 0;
+            re->prefix[re->prefixlen++] = n->literal;
+            return 1;
+        case RN_BOL:
+        case RN_EMPTY:
+            return 1;
+        case RN_CAT:
+            return regex_literal_prefix(re, nodes, n->left) && regex_literal_prefix(re, nodes, n->right);
+    }
+    return 0;
+}
+
+void regex_free(struct regex* re) {
+    if (re == NULL) return;
+    regex_free(re->reverse);
+    int j;
+    for (j = 0; j < re->nstates; j++) free(re->states[j].pcs);
+    free(re->states);
+    free(re->table);
+    free(re->prog);
+    free(re->classes);
+    free(re->prefix);
+    free(re->mark);
+    free(re->scratch);
+    free(re->kernel);
+    free(re->starts);
+    free(re->froms);
+    free(re->runs);
+    free(re->roots);
+    free(re->stamp);
+    free(re->runat);
+    free(re);
+}
+
+void regex_init_dfa(struct regex* re) {
+    re->mark = calloc(re->nprog, sizeof(int));
+    re->scratch = malloc(sizeof(int) * (re->nprog + 1));
+    re->kernel = malloc(sizeof(int) * (re->nprog + 1));
+    re->tablesize = RE_MAX_STATES * 2;
+    re->table = malloc(sizeof(int) * re->tablesize);
+    re->states = malloc(sizeof(struct regex_dstate) * RE_MAX_STATES);
+    memset(re->table, -1, sizeof(int) * re->tablesize);
+    memset(re->start, -1, sizeof(re->start));
+    re->stamp = calloc(RE_MAX_STATES, sizeof(int));
+    re->runat = malloc(sizeof(int) * RE_MAX_STATES);
+}
+
+// NULL if the pattern doesn't parse
+struct regex* regex_compile(const char* pattern, int len) {
+    struct regex* re = calloc(1, sizeof(struct regex));
+    struct regex_parser ps = { pattern, pattern + len, re, NULL, 0, 0, 0 };
+
+    int root = regex_parse_alt(&ps);
+    if (ps.p != ps.end) ps.error = 1; // unmatched )
+    if (!ps.error) {
+        regex_compile_node(re, ps.nodes, root);
+        regex_emit(re, RE_MATCH, 0, 0);
+        re->prefix = malloc(len + 1);
+        regex_literal_prefix(re, ps.nodes, root);
+
+        re->reverse = calloc(1, sizeof(struct regex));
+        re->reverse->reversed = 1;
+        re->reverse->classes = malloc(sizeof(re->classes[0]) * (re->nclasses ? re->nclasses : 1));
+        if (re->reverse->classes == NULL) die("malloc");
+        if (re->nclasses) memcpy(re->reverse->classes, re->classes, sizeof(re->classes[0]) * re->nclasses);
+        re->reverse->nclasses = re->nclasses;
+        regex_compile_node(re->reverse, ps.nodes, root);
+        regex_emit(re->reverse, RE_MATCH, 0, 0);
+    }
+    free(ps.nodes);
+    if (ps.error) {
+        regex_free(re);
+        return NULL;
+    }
+
+    regex_init_dfa(re);
+    regex_init_dfa(re->reverse);
+    return re;
+}
+
+void regex_add(struct regex* re, int pc, int bol, int eol, int* out, int* n) {
+    if (re->mark[pc] == re->gen) return;
+    re->mark[pc] = re->gen;
+    struct regex_inst* in = &re->prog[pc];
+    switch (in->op) {
+        case RE_JMP:
+            regex_add(re, in->x, bol, eol, out, n);
+            break;
+        case RE_SPLIT:
+            regex_add(re, in->x, bol, eol, out, n);
+            regex_add(re, in->y, bol, eol, out, n);
+            break;
+        case RE_BOL:
+            if (bol) regex_add(re, pc + 1, bol, eol, out, n);
+            break;
+        case RE_EOL:
+            out[(*n)++] = pc;
+            if (eol) regex_add(re, pc + 1, bol, eol, out, n);
+            break;
+        default:
+            out[(*n)++] = pc;
+    }
+}
+
+// the instructions reachable from seeds without consuming input, sorted
+int regex_closure(struct regex* re, const int* seeds, int nseeds, int bol, int eol, int* out) {
+    int n = 0;
+    int j;
+    re->gen++;
+    for (j = 0; j < nseeds; j++) regex_add(re, seeds[j], bol, eol, out, &n);
+    for (j = 1; j < n; j++) { // insertion sort, sets are small
+        int pc = out[j], k = j;
+        while (k > 0 && out[k - 1] > pc) {
+            out[k] = out[k - 1];
+            k--;
+        }
+        out[k] = pc;
+    }
+    return n;
+}
+
+unsigned int regex_hash(const int* pcs, int n, int unanchored) {
+    unsigned int h = 2166136261u ^ unanchored;
+    int j;
+    for (j = 0; j < n; j++) h = (h ^ pcs[j]) * 16777619u;
+    return h;
+}
+
+int regex_state(struct regex* re, const int* pcs, int n, int unanchored);
+
+// throw the cached states away but for those in keep, which are renumbered
+void regex_flush(struct regex* re, int* keep, int nkeep) {
+    struct regex_dstate* kept = malloc(sizeof(struct regex_dstate) * (nkeep ? nkeep : 1));
+    if (kept == NULL) die("malloc");
+    int j;
+    for (j = 0; j < nkeep; j++) {
+        kept[j] = re->states[keep[j]];
+        re->states[keep[j]].pcs = NULL;
+    }
+    for (j = 0; j < re->nstates; j++) free(re->states[j].pcs);
+    re->nstates = 0;
+    re->flushes++;
+    memset(re->table, -1, sizeof(int) * re->tablesize);
+    memset(re->start, -1, sizeof(re->start));
+    for (j = 0; j < nkeep; j++) {
+        keep[j] = regex_state(re, kept[j].pcs, kept[j].npcs, kept[j].unanchored);
+        free(kept[j].pcs);
+    }
+    free(kept);
+}
+
+// the dfa state for a set of instructions, made if it doesn't exist yet
+int regex_state(struct regex* re, const int* pcs, int n, int unanchored) {
+    unsigned int mask = re->tablesize - 1;
+    unsigned int h = regex_hash(pcs, n, unanchored) & mask;
+    int j;
+    for (; re->table[h] != -1; h = (h + 1) & mask) {
+        struct regex_dstate* d = &re->states[re->table[h]];
+        if (d->npcs == n && d->unanchored == unanchored && !memcmp(d->pcs, pcs, sizeof(int) * n)) return re->table[h];
+    }
+
+    if (re->nstates == RE_MAX_STATES) { // start over rather than grow without bound
+        regex_flush(re, NULL, 0);
+        h = regex_hash(pcs, n, unanchored) & mask;
+    }
+
+    struct regex_dstate* d = &re->states[re->nstates];
+    d->pcs = malloc(sizeof(int) * (n ? n : 1));
+    memcpy(d->pcs, pcs, sizeof(int) * n);
+    d->npcs = n;
+    d->unanchored = unanchored;
+    for (j = 0; j < 256; j++) d->next[j] = -1;
+
+    d->accept = 0;
+    for (j = 0; j < n; j++) {
+        if (re->prog[pcs[j]].op == RE_MATCH) d->accept = 1;
+    }
+    int m = regex_closure(re, pcs, n, 0, 1, re->scratch);
+    d->accept_eol = 0;
+    for (j = 0; j < m; j++) {
+        if (re->prog[re->scratch[j]].op == RE_MATCH) d->accept_eol = 1;
+    }
+
+    re->table[h] = re->nstates;
+    return re->nstates++;
+}
+
+int regex_start(struct regex* re, int unanchored, int bol) {
+    if (re->start[unanchored][bol] == -1) {
+        int seed = 0;
+        int n = regex_closure(re, &seed, 1, bol, 0, re->kernel);
+        re->start[unanchored][bol] = regex_state(re, re->kernel, n, unanchored);
+    }
+    return re->start[unanchored][bol];
+}
+
+int regex_step(struct regex* re, int s, unsigned char c) {
+    struct regex_dstate* d = &re->states[s];
+    if (d->next[c] != -1) return d->next[c];
+
+    int nseeds = 0;
+    int j;
+    for (j = 0; j < d->npcs; j++) {
+        struct regex_inst* in = &re->prog[d->pcs[j]];
+        if (in->op == RE_SET && regex_class_has(re->classes[in->x], c)) re->scratch[nseeds++] = d->pcs[j] + 1;
+    }
+    int unanchored = d->unanchored;
+    if (unanchored) re->scratch[nseeds++] = 0; // a match may start at every byte
+    int n = regex_closure(re, re->scratch, nseeds, 0, 0, re->kernel);
+
+    int flushes = re->flushes;
+    int t = regex_state(re, re->kernel, n, unanchored);
+    if (re->flushes == flushes) re->states[s].next[c] = t;
+    return t;
+}
+
+// where the first match to start at or after from ends, or -1
+int regex_first_end(struct regex* re, const char* s, int n, int from) {
+    int d = regex_start(re, 1, from == 0);
+    int i;
+    for (i = from; i < n; i++) {
+        if (re->states[d].accept) return i;
+        d = regex_step(re, d, s[i]);
+    }
+    return (re->states[d].accept || re->states[d].accept_eol) ? n : -1;
+}
+
+// length of the longest match starting at st, or -1
+int regex_match_at(struct regex* re, const char* s, int n, int st) {
+    int d = regex_start(re, 0, st == 0);
+    int longest = -1;
+    int i;
+    for (i = st; i < n; i++) {
+        if (re->states[d].accept) longest = i - st;
+        d = regex_step(re, d, s[i]);
+        if (re->states[d].npcs == 0) return longest; // dead
+    }
+    if (re->states[d].accept || re->states[d].accept_eol) longest = n - st;
+    return longest;
+}
+
+// mark where matches can start in a row, with one pass of the reversed
+// pattern from the end of the row back, however many matches it holds
+void regex_mark_starts(struct regex* re, const char* s, int n) {
+    struct regex* rev = re->reverse;
+    if (n + 1 > re->startscap) {
+        re->startscap = n + 1;
+        re->starts = realloc(re->starts, re->startscap);
+        if (re->starts == NULL) die("realloc");
+    }
+    int d = regex_start(rev, 1, 1);
+    int i;
+    for (i = n; i > 0; i--) {
+        re->starts[i] = rev->states[d].accept;
+        d = regex_step(rev, d, s[i - 1]);
+    }
+    re->starts[0] = rev->states[d].accept || rev->states[d].accept_eol;
+    re->startsrow = s;
+    re->startsn = n;
+    re->nfroms = 0; // and the sweep starts over
+    re->nruns = 0;
+    re->sweep = 0;
+    re->sweepflushes = re->flushes;
+}
+
+/* match ends are found in one sweep forward along the row. a run starts
+** at every place the reversed pattern marked, and runs that reach the same
+** dfa state at the same byte have the same future, so the newer one joins
+** the older and only the older goes on. a start's match ends where its own
+** run last accepted, or any run it joined did after it joined. joins only
+** go to older runs, so the chain from a start is no longer than the number
+** of runs that were live when it began */
+
+// the start whose run start f's run is part of now
+int regex_root(struct regex* re, int f) {
+    while (re->froms[f].parent != -1) f = re->froms[f].parent;
+    return f;
+}
+
+void regex_join(struct regex* re, int f, int into, int at) {
+    re->froms[f].parent = into;
+    re->froms[f].joined = at;
+    re->froms[f].live = 0;
+}
+
+// start a run at the sweep's byte
+void regex_sweep_start(struct regex* re) {
+    int p = re->sweep;
+    if (re->nfroms == re->fromscap) {
+        re->fromscap = re->fromscap ? re->fromscap * 2 : 64;
+        re->froms = realloc(re->froms, sizeof(struct regex_from) * re->fromscap);
+        if (re->froms == NULL) die("realloc");
+    }
+    int f = re->nfroms++;
+    struct regex_from* from = &re->froms[f];
+    from->at = p;
+    from->parent = -1;
+    from->last = -1;
+    from->live = 1;
+
+    int d = regex_start(re, 0, p == 0);
+    if (re->stamp[d] == re->stampgen) {
+        regex_join(re, f, re->roots[re->runat[d]], p);
+        return;
+    }
+    if (re->nruns == re->runscap) {
+        re->runscap = re->runscap ? re->runscap * 2 : 16;
+        re->runs = realloc(re->runs, sizeof(int) * re->runscap);
+        re->roots = realloc(re->roots, sizeof(int) * re->runscap);
+        if (re->runs == NULL || re->roots == NULL) die("realloc");
+    }
+    re->stamp[d] = re->stampgen;
+    re->runat[d] = re->nruns;
+    re->runs[re->nruns] = d;
+    re->roots[re->nruns++] = f;
+}
+
+// one byte of the sweep: start a run if a match can start here, note the
+// runs that accept here, then move them all past the byte. returns 0 if
+// there are too many runs to step without throwing their states away
+int regex_sweep_step(struct regex* re, const char* s, int n) {
+    int p = re->sweep;
+    int i;
+    if (re->nstates + re->nruns + 1 > RE_MAX_STATES) { // each run and the new one may make a state
+        regex_flush(re, re->runs, re->nruns);
+        if (re->nstates + re->nruns + 1 > RE_MAX_STATES) return 0;
+        re->sweepflushes = re->flushes;
+    }
+    re->stampgen++;
+    for (i = 0; i < re->nruns; i++) {
+        re->stamp[re->runs[i]] = re->stampgen;
+        re->runat[re->runs[i]] = i;
+    }
+    if (re->starts[p]) regex_sweep_start(re);
+
+    for (i = 0; i < re->nruns; i++) {
+        struct regex_dstate* d = &re->states[re->runs[i]];
+        if (d->accept || (p == n && d->accept_eol)) re->froms[re->roots[i]].last = p;
+    }
+    if (p == n) {
+        for (i = 0; i < re->nruns; i++) re->froms[re->roots[i]].live = 0;
+        re->nruns = 0;
+        re->sweep++;
+        return 1;
+    }
+
+    re->stampgen++;
+    int m = 0;
+    for (i = 0; i < re->nruns; i++) {
+        int t = regex_step(re, re->runs[i], s[p]);
+        if (re->states[t].npcs == 0) { // dead
+            re->froms[re->roots[i]].live = 0;
+            continue;
+        }
+        if (re->stamp[t] == re->stampgen) {
+            regex_join(re, re->roots[i], re->roots[re->runat[t]], p + 1);
+            continue;
+        }
+        re->stamp[t] = re->stampgen;
+        re->runat[t] = m;
+        re->runs[m] = t;
+        re->roots[m++] = re->roots[i];
+    }
+    re->nruns = m;
+    re->sweep++;
+    return 1;
+}
+
+// where the longest match from st ends, st being a start the row's marks
+// hold. the sweep goes on from wherever the last call left it
+int regex_match_end(struct regex* re, const char* s, int n, int st) {
+    if (re->sweep != -1 && re->flushes != re->sweepflushes) { // starts before st don't matter any more
+        re->nfroms = 0;
+        re->nruns = 0;
+        re->sweep = st;
+    }
+    while (re->sweep != -1 && re->sweep <= st) {
+        if (re->nruns == 0 && re->sweep < st) re->sweep = st; // nothing to carry over the bytes between
+        if (!regex_sweep_step(re, s, n)) re->sweep = -1;
+    }
+    if (re->sweep == -1) return st + regex_match_at(re, s, n, st); // one start at a time, as a last resort
+    int lo = 0, hi = re->nfroms - 1;
+    while (lo < hi) { // the starts are in row order
+        int mid = (lo + hi) / 2;
+        if (re->froms[mid].at < st) lo = mid + 1;
+        else hi = mid;
+    }
+    int f = lo;
+    while (re->froms[regex_root(re, f)].live) {
+        if (!regex_sweep_step(re, s, n)) {
+            re->sweep = -1;
+            return st + regex_match_at(re, s, n, st);
+        }
+    }
+
+    int end = re->froms[f].last;
+    for (; re->froms[f].parent != -1; f = re->froms[f].parent) {
+        int joined = re->froms[f].joined;
+        struct regex_from* into = &re->froms[re->froms[f].parent];
+        if (into->last >= joined) end = into->last;
+    }
+    return end;
+}
+
+// the leftmost, then longest, match in a row starting at or after from;
+// returns its start and sets *len, or -1. a search from 0 marks the row's
+// starts and begins its sweep, later ones in the same row go on with them
+int regex_search_from(struct regex* re, const char* s, int n, int from, int* len) {
+    if (from == 0 || s != re->startsrow || n != re->startsn) {
+        if (regex_first_end(re, s, n, from) == -1) return -1; // most rows stop here
+        regex_mark_starts(re, s, n);
+    }
+    int st;
+    for (st = from; st <= n && !re->starts[st]; st++);
+    if (st > n) return -1;
+    *len = regex_match_end(re, s, n, st) - st;
+    return st;
+}
+
+int regex_search(struct regex* re, const char* s, int n, int* len) {
+    return regex_search_from(re, s, n, 0, len);
+}
+
+/* search */
+/* substring search filters candidates by comparing the needle's first and
+** last bytes against a whole vector of positions at once, then memcmps the
+** few that pass. the widest variant the cpu has is picked on first use */
+#define SEARCH_BLOCK (1 << 24) // most bytes of adjacent mapped rows scanned in one call
+
+typedef const char* (*search_fn)(const char* s, size_t n, const char* q, size_t m);
+search_fn search_mem = NULL;
+
+const char* search_scalar(const char* s, size_t n, const char* q, size_t m) {
+    return memmem(s, n, q, m);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+const char* search_sse2(const char* s, size_t n, const char* q, size_t m) {
+    if (m < 2 || n < m) return memmem(s, n, q, m);
+    __m128i first = _mm_set1_epi8(q[0]);
+    __m128i last = _mm_set1_epi8(q[m - 1]);
+    size_t i;
+    for (i = 0; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (!memcmp(s + i + bit + 1, q + 1, m - 2)) return s + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return memmem(s + i, n - i, q, m);
+}
+
+__attribute__((target("avx2")))
+const char* search_avx2(const char* s, size_t n, const char* q, size_t m) {
+    if (m < 2 || n < m) return memmem(s, n, q, m);
+    __m256i first = _mm256_set1_epi8(q[0]);
+    __m256i last = _mm256_set1_epi8(q[m - 1]);
+    size_t i;
+    for (i = 0; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + i + m - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (!memcmp(s + i + bit + 1, q + 1, m - 2)) return s + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return search_sse2(s + i, n - i, q, m);
+}
+#endif
+
+void search_select() {
+    search_mem = search_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) search_mem = search_sse2;
+    if (__builtin_cpu_supports("avx2")) search_mem = search_avx2;
+#endif
+}
+
+/* rows still in the mapping sit back to back, split by their line endings.
+** a query has no control characters, so a run of them is scanned as one
+** block and can't match across a line break */
+int search_adjacent(erow* a, erow* b) {
+    if (!(a->flags & ROW_MAPPED) || !(b->flags & ROW_MAPPED)) return 0;
+    const char* end = a->chars + a->size;
+    return b->chars >= end && b->chars - end <= 2;
+}
+
+// the row among those from `row` (index `at`) on that holds hit
+int search_hit_row(struct row_iter* it, int at, const char* hit, int* cx) {
+    erow* row = row_iter_get(it);
+    while (hit >= row->chars + row->size) {
+        row = row_iter_next(it);
+        at++;
+    }
+    *cx = hit - row->chars;
+    return at;
+}
+
+/* find */
+/* find lists every match up front, so stepping between them is a lookup.
+** the rows are cut into chunks that a pool of workers claim in turn; a
+** worker only reads the row tree and runs its own copy of the dfa, and
+** the chunks' matches are joined in row order when they are all done */
+#define FIND_CHUNKS_PER_THREAD 8 // finer chunks keep every worker busy when matches cluster
+#define FIND_MIN_CHUNK 4096 // rows, smaller buffers are searched by the calling thread alone
+#define FIND_CACHE_LIMIT (256 << 20) // bytes of matches kept for shorter queries, to backspace to
+
+void find_push(struct find_chunk* c, int y, int x, int len) {
+    if (c->n == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 64;
+        c->matches = realloc(c->matches, sizeof(struct find_match) * c->cap);
+        if (c->matches == NULL) die("realloc");
+    }
+    struct find_match* m = &c->matches[c->n++];
+    m->y = y;
+    m->x = x;
+    m->len = len;
+}
+
+// a row's text, copied out if it has a gap since workers may not move it
+const char* find_row_text(erow* row, char** buf, int* cap) {
+    if ((row->flags & ROW_MAPPED) || row->gap == row->size) return row->chars;
+    if (*cap < row->size) {
+        *cap = row->size * 2;
+        *buf = realloc(*buf, *cap);
+        if (*buf == NULL) die("realloc");
+    }
+    memcpy(*buf, row->chars, row->gap);
+    memcpy(*buf + row->gap, row->chars + row->gap + row->gaplen, row->size - row->gap);
+    return *buf;
+}
+
+// every match in one row, matches don't overlap
+void find_row_matches(struct find_chunk* c, struct find_job* job, struct regex* re, const char* s, int n, int y) {
+    int x = 0;
+    if (re == NULL) {
+        const char* hit;
+        while ((hit = search_mem(s + x, n - x, job->q, job->len)) != NULL) {
+            x = hit - s;
+            find_push(c, y, x, job->len);
+            x += job->len;
+        }
+        return;
+    }
+
+    int st, len;
+    while (x <= n && (st = regex_search_from(re, s, n, x, &len)) != -1) {
+        find_push(c, y, st, len);
+        x = st + (len ? len : 1);
+    }
+}
+
+void find_scan_chunk(struct find_job* job, struct regex* re, struct find_chunk* c, char** buf, int* cap) {
+    // only rows holding the query, or the pattern's literal prefix, can match
+    const char* q = re ? re->prefix : job->q;
+    int len = re ? re->prefixlen : job->len;
+
+    struct row_iter it, start;
+    erow* row = row_iter_seek(&it, c->lo);
+    int at = c->lo;
+    int cx;
+    while (row && at < c->hi) {
+        if (!(row->flags & ROW_MAPPED) || len == 0) {
+            const char* text = find_row_text(row, buf, cap);
+            if (len == 0 || search_mem(text, row->size, q, len)) find_row_matches(c, job, re, text, row->size, at);
+            row = row_iter_next(&it);
+            at++;
+            continue;
+        }
+
+        start = it;
+        int start_at = at;
+        const char* base = row->chars;
+        const char* end = base + row->size;
+        erow* prev = row;
+        for (row = row_iter_next(&it), at++; row && at < c->hi; row = row_iter_next(&it), at++) {
+            if (!search_adjacent(prev, row) || row->chars + row->size - base > SEARCH_BLOCK) break;
+            end = row->chars + row->size;
+            prev = row;
+        }
+
+        const char* p = base;
+        const char* hit;
+        while ((hit = search_mem(p, end - p, q, len)) != NULL) {
+            start_at = search_hit_row(&start, start_at, hit, &cx);
+            erow* match = row_iter_get(&start);
+            find_row_matches(c, job, re, match->chars, match->size, start_at);
+            p = match->chars + match->size;
+        }
+    }
+}
+
+// rows a shorter query matched in, the longer one can't match anywhere else
+void find_scan_rows(struct find_job* job, struct find_chunk* c, char** buf, int* cap) {
+    if (c->lo == c->hi) return;
+    struct row_iter it;
+    erow* row = row_iter_seek(&it, job->rows[c->lo]);
+    int at = job->rows[c->lo];
+    int i;
+    for (i = c->lo; i < c->hi; i++) {
+        int y = job->rows[i];
+        if (y - at > LT_ORDER) { // far enough that descending the tree is cheaper
+            row = row_iter_seek(&it, y);
+            at = y;
+        }
+        for (; at < y; at++) row = row_iter_next(&it);
+        const char* text = find_row_text(row, buf, cap);
+        if (job->from == NULL) {
+            find_row_matches(c, job, NULL, text, row->size, y);
+            continue;
+        }
+
+        int end = 0;
+        int j;
+        for (j = job->first[i]; j < job->first[i + 1]; j++) {
+            int x = job->from[j].x;
+            if (x >= end && x + job->len <= row->size && !memcmp(text + x, job->q, job->len)) {
+                find_push(c, y, x, job->len);
+                end = x + job->len;
+            }
+        }
+    }
+}
+
+// claim chunks until there are none left
+void find_run(void* arg) {
+    struct find_job* job = arg;
+    // the dfa is built as it runs, so every thread needs its own
+    struct regex* re = job->regex ? regex_compile(job->q, job->len) : NULL;
+    char* buf = NULL;
+    int cap = 0;
+    int i;
+    while ((i = __sync_fetch_and_add(&job->next, 1)) < job->nchunks) {
+        if (job->rows) {
+            find_scan_rows(job, &job->chunks[i], &buf, &cap);
+        } else {
+            find_scan_chunk(job, re, &job->chunks[i], &buf, &cap);
         }
     }
+    regex_free(re);
+    free(buf);
 }
 
-/* row operations */
-int editor_row_cxtorx(erow* row, int cx) {
-    int rx = 0;
-    int j;
-    for (j = 0; j < cx; j++) {
-        if (row->chars[j] == '\t') {
-            rx += (TAB_STOP - 1) - (rx % TAB_STOP);
-        }
-        rx++;
+// whether two occurrences of q can overlap, that is some prefix is also a suffix
+int find_overlaps(const char* q, int len) {
+    int k;
+    for (k = 1; k < len; k++) {
+        if (!memcmp(q, q + len - k, k)) return 1;
     }
-    return rx;
+    return 0;
 }
 
-int editor_row_rxtocx(erow* row, int rx) {
-    int cur_rx = 0;
-    int cx;
-    for (cx = 0; cx < row->size; cx++) {
-        if (row->chars[cx] == '\t') {
-            cur_rx += (TAB_STOP - 1) - (cur_rx % TAB_STOP);
+/* every match of q in the buffer, in order, and their number in *n.
+** from is the result for a literal q is an extension of, only the rows it
+** matched in are searched; NULL searches them all */
+struct find_match* find_all(const char* q, int len, int regex, const struct find_result* from, int* n) {
+    if (search_mem == NULL) search_select();
+
+    int* rows = NULL;
+    int* first = NULL;
+    int nrows = ES.numrows;
+    int i;
+    if (from) {
+        rows = malloc(sizeof(int) * (from->nmatches + 1));
+        first = malloc(sizeof(int) * (from->nmatches + 1));
+        nrows = 0;
+        for (i = 0; i < from->nmatches; i++) {
+            if (nrows == 0 || rows[nrows - 1] != from->matches[i].y) {
+                first[nrows] = i;
+                rows[nrows++] = from->matches[i].y;
+            }
+        }
+        first[nrows] = from->nmatches;
+        if (nrows == 0) {
+            free(rows);
+            free(first);
+            *n = 0;
+            return malloc(sizeof(struct find_match));
         }
-        cur_rx++;
-        if (cur_rx > rx) return cx;
     }
-    return cx;
-}
+    // when the shorter query can't overlap itself its matches were all of its
+    // occurrences, so the longer one can only start where they did
+    int exact = from && !find_overlaps(from->query, strlen(from->query));
+
+    int nchunks = 1;
+    if (nrows >= 2 * FIND_MIN_CHUNK) {
+        nchunks = pool_threads() * FIND_CHUNKS_PER_THREAD;
+        if (nchunks > nrows / FIND_MIN_CHUNK) nchunks = nrows / FIND_MIN_CHUNK;
+    }
 
-void update_row(erow* row) {
-    int tabs = 0;
-    int j;
+    struct find_job job = { q, len, regex, rows, exact ? from->matches : NULL, first,
+                            calloc(nchunks, sizeof(struct find_chunk)), nchunks, 0 };
+    for (i = 0; i < nchunks; i++) {
+        job.chunks[i].lo = (long long)nrows * i / nchunks;
+        job.chunks[i].hi = (long long)nrows * (i + 1) / nchunks;
+    }
 
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') tabs++;
+    if (nchunks > 1) {
+        pool_run(find_run, &job);
+    } else {
+        find_run(&job);
     }
 
-    free(row->render);
-    row->render = malloc(row->size + tabs*(TAB_STOP-1) + 1);
+    // the chunks are in row order, so joining them keeps the index sorted
+    *n = 0;
+    for (i = 0; i < nchunks; i++) *n += job.chunks[i].n;
+    struct find_match* matches = malloc(sizeof(struct find_match) * (*n ? *n : 1));
+    if (matches == NULL) die("malloc");
+    struct find_match* m = matches;
+    for (i = 0; i < nchunks; i++) {
+        if (job.chunks[i].n == 0) continue; // never pushed to, so it has no matches array
+        memcpy(m, job.chunks[i].matches, sizeof(struct find_match) * job.chunks[i].n);
+        m += job.chunks[i].n;
+        free(job.chunks[i].matches);
+    }
+    free(job.chunks);
+    free(rows);
+    free(first);
+    return matches;
+}
 
-    int idx = 0;
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            while (idx % TAB_STOP != 0) row->render[idx++] = ' ';
+// index of the first match at or after (y, x), nmatches if there is none
+int find_match_after(int y, int x) {
+    int lo = 0, hi = ES.find.nmatches;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        struct find_match* m = &ES.find.matches[mid];
+        if (m->y < y || (m->y == y && m->x < x)) {
+            lo = mid + 1;
         } else {
-            row->render[idx++] = row->chars[j];
+            hi = mid;
         }
     }
-    row->render[idx] = '\0';
-    row->rsize = idx;
+    return lo;
+}
 
-    update_syntax(row);
+void find_pop() {
+    struct find_result* r = &ES.find.results[--ES.find.nresults];
+    if (r->matches) ES.find.cached -= sizeof(struct find_match) * r->nmatches;
+    free(r->query);
+    free(r->matches);
 }
 
-void editor_insert_row(int at, char* s, size_t len) {
-    if (at < 0 || at > ES.numrows) return;
+void find_forget() {
+    while (ES.find.nresults > 0) find_pop();
+    ES.find.matches = NULL;
+    ES.find.nmatches = 0;
+    ES.find.current = -1;
+}
+
+/* point the prompt at the matches for query, returns whether they changed.
+** a literal query that grows is only searched for where the shorter one
+** matched, and a query that shrinks gets back the result it had before */
+int find_update(const char* query, int len, int regex) {
+    int changed = (ES.find.matches == NULL);
+    struct find_result* top;
+    while (ES.find.nresults > 0) { // drop results for queries this one doesn't extend
+        top = &ES.find.results[ES.find.nresults - 1];
+        int toplen = strlen(top->query);
+        if (top->regex == regex && toplen <= len && !memcmp(top->query, query, toplen)) {
+            if (toplen < len || top->matches) break;
+        }
+        find_pop();
+        changed = 1;
+    }
+    top = ES.find.nresults ? &ES.find.results[ES.find.nresults - 1] : NULL;
+
+    if (top == NULL || strcmp(top->query, query)) {
+        // a longer pattern can match where a shorter one didn't, so regexes are searched afresh
+        const struct find_result* from = (top && top->matches && !regex) ? top : NULL;
+        if (ES.find.nresults == ES.find.capresults) {
+            ES.find.capresults = ES.find.capresults ? ES.find.capresults * 2 : 16;
+            ES.find.results = realloc(ES.find.results, sizeof(struct find_result) * ES.find.capresults);
+        }
+        top = &ES.find.results[ES.find.nresults];
+        top->matches = find_all(query, len, regex, from, &top->nmatches);
+        top->query = strdup(query);
+        top->regex = regex;
+        ES.find.nresults++;
+        ES.find.cached += sizeof(struct find_match) * top->nmatches;
+        changed = 1;
+
+        // past the limit the oldest, and biggest, results are dropped first
+        int i;
+        for (i = 0; ES.find.cached > FIND_CACHE_LIMIT && i < ES.find.nresults - 1; i++) {
+            struct find_result* r = &ES.find.results[i];
+            if (r->matches == NULL) continue;
+            ES.find.cached -= sizeof(struct find_match) * r->nmatches;
+            free(r->matches);
+            r->matches = NULL;
+        }
+    }
 
-    ES.row = realloc(ES.row, sizeof(erow) * (ES.numrows + 1));
-    memmove(&ES.row[at + 1], &ES.row[at], sizeof(erow) * (ES.numrows - at));
-    for (int j = at + 1; j <= ES.numrows; j++) ES.row[j].idx++;
+    ES.find.matches = top->matches;
+    ES.find.nmatches = top->nmatches;
+    return changed;
+}
 
-    ES.row[at].idx = at;
+void editor_find_callback(char* query, int key) {
+    if (key == '\r' || key == '\x1b') return;
+    if (key == CTRL_KEY('r')) ES.find.regex = !ES.find.regex;
+
+    int len = strlen(query);
+    int bad = 0;
+    if (ES.find.regex) { // recompiled only when the pattern changes
+        if (ES.find.pattern == NULL || strcmp(ES.find.pattern, query)) {
+            regex_free(ES.find.re);
+            free(ES.find.pattern);
+            ES.find.re = regex_compile(query, len);
+            ES.find.pattern = strdup(query);
+        }
+        bad = (ES.find.re == NULL);
+    }
+    snprintf(ES.find.prompt, sizeof(ES.find.prompt), "%s: %%s (Ctrl-R %s, ARROWS/ENTER/ESC)%s",
+             ES.find.regex ? "regex search" : "search", ES.find.regex ? "literal" : "regex",
+             bad ? " bad pattern" : "");
 
-    ES.row[at].size = len;
-    ES.row[at].chars = malloc(len+1);
-    memcpy(ES.row[at].chars, s, len);
-    ES.row[at].chars[len] = '\0';
+    if (len == 0 || bad) { // the cached results stay for when the query is fixed
+        ES.find.matches = NULL;
+        ES.find.nmatches = 0;
+        return;
+    }
+    if (find_update(query, len, ES.find.regex)) ES.find.current = -1;
 
-    ES.row[at].rsize = 0;
-    ES.row[at].render = NULL;
-    ES.row[at].hl = NULL;
-    ES.row[at].hl_open_comment = 0;
-    update_row(&ES.row[at]);
+    int n = ES.find.nmatches;
+    if (n == 0) return;
+    if (ES.find.current == -1) {
+        ES.find.current = find_match_after(ES.find.origin_y, ES.find.origin_x) % n;
+    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        ES.find.current = (ES.find.current + 1) % n;
+    } else if (key == ARROW_LEFT || key == ARROW_UP) {
+        ES.find.current = (ES.find.current + n - 1) % n;
+    }
 
-    ES.numrows++;
-    ES.dirty++;
+    struct find_match* m = &ES.find.matches[ES.find.current];
+    ES.cy = m->y;
+    ES.cx = m->x;
+    ES.rowoff = ES.numrows;
 }
 
-void editor_free_row(erow* row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+void editor_find() {
+    int saved_cx = ES.cx;
+    int saved_cy = ES.cy;
+    int saved_coloff = ES.coloff;
+    int saved_rowoff = ES.rowoff;
+
+    ES.find.active = 1;
+    ES.find.origin_y = ES.cy;
+    ES.find.origin_x = ES.cx;
+    // the callback rewrites the prompt as the mode changes
+    snprintf(ES.find.prompt, sizeof(ES.find.prompt), "%s: %%s (Ctrl-R %s, ARROWS/ENTER/ESC)",
+             ES.find.regex ? "regex search" : "search", ES.find.regex ? "literal" : "regex");
+    char* query = editor_prompt(ES.find.prompt, editor_find_callback, 0);
+    ES.find.active = 0;
+    find_forget();
+    if (query) {
+        free(query);
+    } else {
+        ES.cx = saved_cx;
+        ES.cy = saved_cy;
+        ES.coloff = saved_coloff;
+        ES.rowoff = saved_rowoff;
+    }
 }
 
-void editor_delete_row(int at) {
-    if (at < 0 || at >= ES.numrows) return;
-    editor_free_row(&ES.row[at]);
-    memmove(&ES.row[at], &ES.row[at + 1], sizeof(erow) * (ES.numrows - at - 1));
-    for (int j = at; j < ES.numrows - 1; j++) ES.row[j].idx--;
-    ES.numrows--;
-    ES.dirty++;
+/* replace */
+/* replace-all finds every match with find_all, then hands each row's
+** matches to row_replace_spans, which builds the row's new chars in one
+** allocation and leaves render and hl to be rebuilt when it is drawn. the
+** whole replace is one undo record of spans */
+void editor_replace_callback(char* query, int key) {
+    (void)query;
+    if (key == CTRL_KEY('r')) ES.find.regex = !ES.find.regex;
+    snprintf(ES.find.prompt, sizeof(ES.find.prompt), "%s: %%s (Ctrl-R %s, ESC to cancel)",
+             ES.find.regex ? "replace regex" : "replace", ES.find.regex ? "literal" : "regex");
 }
 
-void row_insert_char(erow* row, int at, int c) {
-    if (at < 0 || at > row->size) at = row->size;
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
-    update_row(row);
-    ES.dirty++;
+// replace every match of q, returns how many there were and sets *rows to the rows they were in
+int replace_all(const char* q, int len, int regex, const char* with, int wlen, int* rows) {
+    int n;
+    struct find_match* m = find_all(q, len, regex, NULL, &n);
+    char* spans = NULL;
+    size_t cap = 0;
+    struct row_iter it;
+    erow* row = NULL;
+    int at = 0;
+    int i, j;
+    *rows = 0;
+    for (i = 0; i < n; i = j) {
+        int y = m[i].y;
+        if (row == NULL || y - at > LT_ORDER) {
+            row = row_iter_seek(&it, y);
+            at = y;
+        }
+        for (; at < y; at++) row = row_iter_next(&it);
+
+        // the row's matches with the text each covers
+        const char* chars = row_chars(row);
+        size_t slen = 0;
+        for (j = i; j < n && m[j].y == y; j++) {
+            if (slen + sizeof(struct find_match) + m[j].len > cap) {
+                cap = (slen + sizeof(struct find_match) + m[j].len) * 2;
+                spans = realloc(spans, cap);
+            }
+            memcpy(&spans[slen], &m[j], sizeof(struct find_match));
+            slen += sizeof(struct find_match);
+            memcpy(&spans[slen], &chars[m[j].x], m[j].len);
+            slen += m[j].len;
+        }
+        row_replace_spans(row, y, with, wlen, spans, spans + slen, 1);
+        (*rows)++;
+    }
+    if (ES.cy < ES.numrows && ES.cx > editor_row(ES.cy)->size) ES.cx = editor_row(ES.cy)->size;
+    free(spans);
+    free(m);
+    return n;
 }
 
-void row_append_string(erow* row, char* s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    update_row(row);
-    ES.dirty++;
+void editor_replace() {
+    editor_replace_callback(NULL, 0);
+    char* query = editor_prompt(ES.find.prompt, editor_replace_callback, 0);
+    if (query == NULL) {
+        editor_set_statusmessage("replace aborted");
+        return;
+    }
+    int len = strlen(query);
+    if (ES.find.regex) {
+        struct regex* re = regex_compile(query, len);
+        if (re == NULL) {
+            editor_set_statusmessage("bad pattern: %s", query);
+            free(query);
+            return;
+        }
+        regex_free(re);
+    }
+    char* with = editor_prompt("replace with: %s (ESC to cancel)", NULL, 1);
+    if (with == NULL) {
+        editor_set_statusmessage("replace aborted");
+        free(query);
+        return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int rows;
+    int n = replace_all(query, len, ES.find.regex, with, strlen(with), &rows);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    editor_set_statusmessage("replaced %d matches in %d rows in %.0fms", n, rows, ms);
+    free(query);
+    free(with);
 }
 
-void row_delete_char(erow* row, int at) {
-    if (at < 0 || at >= row->size) return;
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    update_row(row);
-    ES.dirty++;
+/* frame */
+/* output for a frame is gathered into an arena that is kept between frames,
+** long runs of text are pointed at in the screen grid instead of copied,
+** and the lot goes out in one writev */
+#define FRAME_COPY_MAX 64 // longer runs of text are written straight from the screen grid
+#define FRAME_IOV 1024 // iovecs one frame may use, within IOV_MAX
+
+void frame_reserve(struct frame* f, int cap) {
+    if (f->cap >= cap) return;
+    char* new = realloc(f->b, cap);
+    if (new == NULL) die("realloc");
+    f->b = new;
+    f->cap = cap;
+    if (f->iov == NULL) {
+        f->iov = malloc(sizeof(struct iovec) * FRAME_IOV);
+        if (f->iov == NULL) die("malloc");
+    }
 }
 
-/* editor operations */
-void editor_insert_char(int c) {
-    if (ES.cy == ES.numrows) { editor_insert_row(ES.numrows, "", 0); }
-    row_insert_char(&ES.row[ES.cy], ES.cx, c);
-    ES.cx++;
+void frame_begin(struct frame* f) {
+    f->len = 0;
+    f->mark = 0;
+    f->niov = 0;
 }
 
-void editor_insert_newline() {
-    if (ES.cx == 0) {
-        editor_insert_row(ES.cy, "", 0);
-    } else {
-        erow* row = &ES.row[ES.cy];
-        editor_insert_row(ES.cy + 1, &row->chars[ES.cx], row->size - ES.cx);
-        row = &ES.row[ES.cy];
-        row->size = ES.cx;
-        row->chars[row->size] = '\0';
-        update_row(row);
-    }
-    ES.cy++;
-    ES.cx = 0;
+void frame_append(struct frame* f, const char* s, int len) {
+    if (f->len + len > f->cap) frame_reserve(f, (f->len + len) * 2);
+    memcpy(&f->b[f->len], s, len);
+    f->len += len;
 }
 
-void editor_delete_char() {
-    if (ES.cy == ES.numrows) return;
-    if (ES.cx == 0 && ES.cy == 0) return;
+// arena bytes since the last iovec become one, its base is filled in on flush
+void frame_close_segment(struct frame* f) {
+    if (f->len == f->mark) return;
+    f->iov[f->niov].iov_base = NULL;
+    f->iov[f->niov].iov_len = f->len - f->mark;
+    f->niov++;
+    f->mark = f->len;
+}
 
-    erow* row = &ES.row[ES.cy];
-    if (ES.cx > 0) {
-        row_delete_char(row, ES.cx - 1);
-        ES.cx--;
-    } else {
-        ES.cx = ES.row[ES.cy - 1].size;
-        row_append_string(&ES.row[ES.cy - 1], row->chars, row->size);
-        editor_delete_row(ES.cy);
-        ES.cy--;
+// text must stay put until the frame is flushed
+void frame_text(struct frame* f, const char* s, int len) {
+    if (len < FRAME_COPY_MAX || f->niov + 2 > FRAME_IOV) {
+        frame_append(f, s, len);
+        return;
     }
+    frame_close_segment(f);
+    f->iov[f->niov].iov_base = (void*)s;
+    f->iov[f->niov].iov_len = len;
+    f->niov++;
 }
 
-/* file i/o */
+// returns the bytes in the frame
+long long frame_flush(struct frame* f, int fd) {
+    frame_close_segment(f);
 
-char* rows_to_string(int* buflen) {
-    int total_len = 0;
+    char* b = f->b;
+    long long n = 0;
     int j;
-    for (j = 0; j < ES.numrows; j++) {
-        total_len += ES.row[j].size + 1;
+    for (j = 0; j < f->niov; j++) {
+        if (f->iov[j].iov_base == NULL) {
+            f->iov[j].iov_base = b;
+            b += f->iov[j].iov_len;
+        }
+        n += f->iov[j].iov_len;
     }
-    *buflen = total_len;
 
-    char* buf = malloc(total_len);
-    char* p = buf;
-    for (j = 0; j < ES.numrows; j++) {
-        memcpy(p, ES.row[j].chars, ES.row[j].size);
-        p += ES.row[j].size;
-        *p = '\n';
-        p++;
+    if (ES.bench.active) { // counted instead of written
+        bench_frame(n);
+        return n;
     }
-    return buf;
+    writev_all(fd, f->iov, f->niov);
+    return n;
 }
 
-void editor_open(char* filename) {
-    free(ES.filename);
-    ES.filename = strdup(filename);
+/* screen */
+/* the frame is composed into a grid of cells and compared against a copy
+** of what the terminal already shows, so only changed spans are written */
+#define SCREEN_GAP 4 // unchanged cells worth rewriting to avoid a cursor move
+
+void screen_init(int rows, int cols) {
+    free(ES.screen.chars);
+    free(ES.screen.attrs);
+    free(ES.screen.shadow_chars);
+    free(ES.screen.shadow_attrs);
+    ES.screen.rows = rows;
+    ES.screen.cols = cols;
+    ES.screen.chars = malloc(rows * cols);
+    ES.screen.attrs = malloc(rows * cols);
+    ES.screen.shadow_chars = malloc(rows * cols);
+    ES.screen.shadow_attrs = malloc(rows * cols);
+    ES.screen.valid = 0;
+
+    int attr;
+    for (attr = 0; attr < 256; attr++) {
+        int hl = attr & ~ATTR_INVERSE;
+        if (attr == HL_NORMAL) {
+            ES.screen.sgrlen[attr] = snprintf(ES.screen.sgr[attr], sizeof(ES.screen.sgr[attr]), "\x1b[m");
+        } else {
+            ES.screen.sgrlen[attr] = snprintf(ES.screen.sgr[attr], sizeof(ES.screen.sgr[attr]), "\x1b[0;%s%dm",
+                                              (attr & ATTR_INVERSE) ? "7;" : "",
+                                              hl == HL_NORMAL ? 39 : syntax_to_color(hl));
+        }
+    }
 
-    select_syntax_highlight();
+    // the most a frame can take: every cell changing attribute, and a cursor move per row
+    frame_reserve(&ES.frame, rows * cols * (sizeof(ES.screen.sgr[0]) + 1) + rows * 32 + 64);
+}
 
-    FILE *fp = fopen(filename, "r");
-    if (!fp) die("fopen");
+void screen_invalidate() {
+    ES.screen.valid = 0;
+}
 
-    char* line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
+char* screen_chars(int y) {
+    return &ES.screen.chars[y * ES.screen.cols];
+}
 
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                               line[linelen - 1] == '\r')) {
-            linelen--;
-        }
-        editor_insert_row(ES.numrows, line, linelen);
-    }
-    free(line);
-    fclose(fp);
-    ES.dirty = 0;
+unsigned char* screen_attrs(int y) {
+    return &ES.screen.attrs[y * ES.screen.cols];
 }
 
-void editor_save() {
-    // TODO:
-    // * use temporary file
-    if (ES.filename == NULL) {
-        ES.filename = editor_prompt("save as: %s (ESC to cancel)", NULL);
-        if (ES.filename == NULL) {
-            editor_set_statusmessage("save aborted");
-            return;
-        }
-        select_syntax_highlight();
-    }
+void screen_clear_row(int y) {
+    memset(screen_chars(y), ' ', ES.screen.cols);
+    memset(screen_attrs(y), HL_NORMAL, ES.screen.cols);
+}
 
-    int len;
-    char* buf = rows_to_string(&len);
-
-    int fd = open(ES.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                ES.dirty = 0;
-                editor_set_statusmessage("%d bytes written to disk", len);
-                return;
-            }
-        }
-        close(fd);
+void screen_put(int y, int x, const char* s, int len, int attr) {
+    if (x + len > ES.screen.cols) len = ES.screen.cols - x;
+    if (len <= 0) return;
+    memcpy(&screen_chars(y)[x], s, len);
+    memset(&screen_attrs(y)[x], attr, len);
+}
+
+// cells past the returned column are blank
+int screen_row_end(const char* chars, const unsigned char* attrs, int cols) {
+    while (cols > 0 && chars[cols - 1] == ' ' && attrs[cols - 1] == HL_NORMAL) cols--;
+    return cols;
+}
+
+int screen_row_is_ascii(const char* chars, int cols) {
+    int j;
+    for (j = 0; j < cols; j++) {
+        if ((unsigned char)chars[j] >= 0x80) return 0;
     }
-    free(buf);
-    editor_set_statusmessage("save failed. I/O error: %s", strerror(errno));
+    return 1;
 }
 
-/* find */
-void editor_find_callback(char* query, int key) {
-    static int last_match = -1;
-    static int direction = 1;
+void screen_move(struct frame* f, int y, int x) {
+    if (ES.screen.cur_y == y && ES.screen.cur_x == x) return;
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+    frame_append(f, buf, len);
+    ES.screen.cur_y = y;
+    ES.screen.cur_x = x;
+}
 
-    static int saved_hl_line;
-    static char* saved_hl = NULL;
+void screen_attr(struct frame* f, int attr) {
+    if (ES.screen.cur_attr == attr) return;
+    frame_append(f, ES.screen.sgr[attr], ES.screen.sgrlen[attr]);
+    ES.screen.cur_attr = attr;
+}
 
-    if (saved_hl) {
-        memcpy(ES.row[saved_hl_line].hl, saved_hl, ES.row[saved_hl_line].rsize);
-        free(saved_hl);
-        saved_hl = NULL;
+// write cells from..to of a row, a run of one attribute at a time
+void screen_emit(struct frame* f, const char* chars, const unsigned char* attrs, int from, int to) {
+    while (from < to) {
+        int end = from + 1;
+        while (end < to && attrs[end] == attrs[from]) end++;
+        screen_attr(f, attrs[from]);
+        frame_text(f, &chars[from], end - from);
+        from = end;
     }
+    ES.screen.cur_x = (to < ES.screen.cols) ? to : -1; // the last column leaves a pending wrap
+}
 
-    if (key == '\r' || key == '\x1b') {
-        last_match = -1;
-        direction = 1;
+void screen_flush_row(struct frame* f, int y) {
+    int cols = ES.screen.cols;
+    const char* new = &ES.screen.chars[y * cols];
+    const unsigned char* newattr = &ES.screen.attrs[y * cols];
+    const char* old = &ES.screen.shadow_chars[y * cols];
+    const unsigned char* oldattr = &ES.screen.shadow_attrs[y * cols];
+    if (!memcmp(new, old, cols) && !memcmp(newattr, oldattr, cols)) return;
+
+    int newend = screen_row_end(new, newattr, cols);
+    int oldend = screen_row_end(old, oldattr, cols);
+
+    if (!screen_row_is_ascii(new, newend) || !screen_row_is_ascii(old, oldend)) {
+        // multibyte text doesn't take one column per cell, rewrite the whole line
+        screen_move(f, y, 0);
+        screen_emit(f, new, newattr, 0, newend);
+        screen_attr(f, HL_NORMAL);
+        frame_append(f, "\x1b[K", 3);
+        ES.screen.cur_x = -1;
         return;
-    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    } else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
-    } else {
-        last_match = -1;
-        direction = 1;
     }
 
-    if (last_match == -1) direction = 1;
-    int current = last_match;
-
-    int i;
-    for (i = 0; i < ES.numrows; i++) {
-        current += direction;
-        if (current == -1) current = ES.numrows -1;
-        else if (current == ES.numrows) current = 0;
-        erow *row = &ES.row[current];
-        char *match = strstr(row->render, query);
-        if (match) {
-            last_match = current;
-            ES.cy = current;
-            ES.cx = editor_row_rxtocx(row, match - row->render);
-            ES.rowoff = ES.numrows;
-
-            saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-            break;
+    int x = 0;
+    while (x < newend) {
+        if (new[x] == old[x] && newattr[x] == oldattr[x]) {
+            x++;
+            continue;
+        }
+        int end = x + 1;
+        int gap = 0;
+        int j;
+        for (j = x + 1; j < newend; j++) {
+            if (new[j] != old[j] || newattr[j] != oldattr[j]) {
+                end = j + 1;
+                gap = 0;
+            } else if (++gap > SCREEN_GAP) {
+                break;
+            }
         }
+        screen_move(f, y, x);
+        screen_emit(f, new, newattr, x, end);
+        x = end;
+    }
+    if (oldend > newend) {
+        screen_move(f, y, newend);
+        screen_attr(f, HL_NORMAL);
+        frame_append(f, "\x1b[K", 3); // clear line right of cursor
     }
 }
 
-void editor_find() {
-    int saved_cx = ES.cx;
-    int saved_cy = ES.cy;
-    int saved_coloff = ES.coloff;
-    int saved_rowoff = ES.rowoff;
+// rows in [0, region) that show what the shadow has `shift` rows below them
+int screen_region_matches(int region, int shift) {
+    int cols = ES.screen.cols;
+    int n = 0;
+    int y;
+    for (y = 0; y < region; y++) {
+        int from = y + shift;
+        if (from < 0 || from >= region) continue;
+        if (!memcmp(&ES.screen.chars[y * cols], &ES.screen.shadow_chars[from * cols], cols) &&
+            !memcmp(&ES.screen.attrs[y * cols], &ES.screen.shadow_attrs[from * cols], cols)) n++;
+    }
+    return n;
+}
 
-    char* query = editor_prompt("search: %s (ARROWS/ENTER/ESC)", editor_find_callback);
-    if (query) {
-        free(query);
+/* move what the terminal shows in rows [0, region) up `shift` rows, down
+** if it is negative, within a scroll region and the shadow with it, so
+** only the rows it uncovers differ */
+void screen_scroll(struct frame* f, int region, int shift) {
+    int cols = ES.screen.cols;
+    int n = abs(shift);
+    char buf[48];
+    screen_attr(f, HL_NORMAL); // uncovered rows are blank in the current colors
+    int len = snprintf(buf, sizeof(buf), "\x1b[1;%dr\x1b[%d%c\x1b[r", region, n, shift > 0 ? 'S' : 'T');
+    frame_append(f, buf, len);
+    ES.screen.cur_y = ES.screen.cur_x = 0; // setting the region homes the cursor
+
+    char* chars = ES.screen.shadow_chars;
+    unsigned char* attrs = ES.screen.shadow_attrs;
+    int kept = (region - n) * cols;
+    int blank;
+    if (shift > 0) {
+        memmove(chars, &chars[n * cols], kept);
+        memmove(attrs, &attrs[n * cols], kept);
+        blank = kept;
     } else {
-        ES.cx = saved_cx;
-        ES.cy = saved_cy;
-        ES.coloff = saved_coloff;
-        ES.rowoff = saved_rowoff;
+        memmove(&chars[n * cols], chars, kept);
+        memmove(&attrs[n * cols], attrs, kept);
+        blank = 0;
     }
+    memset(&chars[blank], ' ', n * cols);
+    memset(&attrs[blank], HL_NORMAL, n * cols);
 }
 
-/* append buffer */
-struct abuf {
-    char *b;
-    int len;
-};
-#define ABUF_INT {NULL, 0}
-
-void ab_append(struct abuf* ab, const char* s, int len) {
-    char* new = realloc(ab->b, ab->len + len);
+/* write what changed since the last frame and place the cursor at (y, x).
+** the content of rows [0, region) moved up `shift` rows since the last
+** frame, or is likely to have, in which case the terminal is told to
+** scroll them if that leaves less to draw. the frame is wrapped in
+** synchronized output so the terminal shows it all at once */
+void screen_flush(struct frame* f, int y, int x, int region, int shift) {
+    int size = ES.screen.rows * ES.screen.cols;
+    int full = !ES.screen.valid;
+
+    if (full) {
+        frame_append(f, "\x1b[?2026h\x1b[?25l\x1b[m\x1b[H\x1b[2J", 24);
+        memset(ES.screen.shadow_chars, ' ', size);
+        memset(ES.screen.shadow_attrs, HL_NORMAL, size);
+        ES.screen.cur_y = ES.screen.cur_x = 0;
+        ES.screen.cur_attr = HL_NORMAL;
+        ES.screen.valid = 1;
+    } else {
+        frame_append(f, "\x1b[?2026h\x1b[?25l", 14); // begin synchronized update, hide cursor
+    }
+    int start = f->len;
 
-    if (new == NULL) { return; }
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
-    ab->len += len;
-}
+    if (!full && shift && abs(shift) < region &&
+        screen_region_matches(region, shift) > screen_region_matches(region, 0)) {
+        screen_scroll(f, region, shift);
+    }
 
-void ab_free(struct abuf* ab) {
-    free(ab->b);
+    int j;
+    for (j = 0; j < ES.screen.rows; j++) screen_flush_row(f, j);
+    screen_attr(f, HL_NORMAL);
+
+    // what was just composed is what the terminal will show
+    char* chars = ES.screen.shadow_chars;
+    unsigned char* attrs = ES.screen.shadow_attrs;
+    ES.screen.shadow_chars = ES.screen.chars;
+    ES.screen.shadow_attrs = ES.screen.attrs;
+    ES.screen.chars = chars;
+    ES.screen.attrs = attrs;
+
+    if (f->len == start && f->niov == 0 && !full) { // nothing was drawn, the cursor is all that moves
+        frame_begin(f);
+        screen_move(f, y, x);
+        return;
+    }
+    screen_move(f, y, x);
+    frame_append(f, "\x1b[?25h\x1b[?2026l", 14); // show cursor, end synchronized update
 }
 
 /* output */
 void editor_scroll() {
     ES.rx = 0;
     if (ES.cy < ES.numrows) {
-        ES.rx = editor_row_cxtorx(&ES.row[ES.cy], ES.cx);
+        ES.rx = editor_row_cxtorx(editor_row(ES.cy), ES.cx);
     }
 
     if (ES.cy < ES.rowoff) {
@@ -744,11 +4664,13 @@ void editor_scroll() {
     }
 }
 
-void draw_rows(struct abuf* ab) {
+void draw_rows() {
+    struct row_iter it;
+    erow* row = row_iter_seek(&it, ES.rowoff);
     int y;
-    for (y=0; y < ES.screenrows; y++) {
-        int filerow = y + ES.rowoff;
-        if (filerow >= ES.numrows) {
+    for (y=0; y < ES.screenrows; y++, row = row_iter_next(&it)) {
+        screen_clear_row(y);
+        if (row == NULL) {
             if (ES.numrows == 0 && y == ES.screenrows / 3) {
                 char welcome[80];
                 int welcomelen = snprintf(welcome, sizeof(welcome), "welcome to inn -- version %s", INN_VERSION);
@@ -756,112 +4678,121 @@ void draw_rows(struct abuf* ab) {
 
                 int padding = (ES.screencols - welcomelen) / 2;
                 if (padding) {
-                    ab_append(ab, "~", 1);
+                    screen_put(y, 0, "~", 1, HL_NORMAL);
                 }
-                while (padding--) { ab_append(ab, " ", 1); }
-
-                ab_append(ab, welcome, welcomelen);
+                screen_put(y, padding, welcome, welcomelen, HL_NORMAL);
             } else {
-                ab_append(ab, "~", 1);
+                screen_put(y, 0, "~", 1, HL_NORMAL);
             }
         } else {
-            int len = ES.row[filerow].rsize - ES.coloff;
+            editor_highlight_row(row, ES.rowoff + y);
+            row_window(row, ES.coloff, ES.screencols);
+            int len = row->rstart + row->rsize - ES.coloff;
             if (len < 0 ) len = 0;
             if (len > ES.screencols) len = ES.screencols;
-            char* c = &ES.row[filerow].render[ES.coloff];
-            unsigned char* hl = &ES.row[filerow].hl[ES.coloff];
-            int current_color = -1;
+            char* chars = screen_chars(y);
+            unsigned char* attrs = screen_attrs(y);
+            memcpy(chars, &row->render[ES.coloff - row->rstart], len);
+            memcpy(attrs, &row->hl[ES.coloff - row->rstart], len);
+            if (ES.find.active && ES.find.matches && ES.find.current >= 0 &&
+                ES.find.matches[ES.find.current].y == ES.rowoff + y) { // the match find is on
+                struct find_match* m = &ES.find.matches[ES.find.current];
+                int from = editor_row_cxtorx(row, m->x) - ES.coloff;
+                int to = editor_row_cxtorx(row, m->x + m->len) - ES.coloff;
+                if (from < 0) from = 0;
+                if (to > len) to = len;
+                if (from < to) memset(&attrs[from], HL_MATCH, to - from);
+            }
             int j;
             for (j = 0; j < len; j++) {
-                if (iscntrl(c[j])) {
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    ab_append(ab, "\x1b[7m", 4);
-                    ab_append(ab, &sym, 1);
-                    ab_append(ab, "\x1b[m", 3);
-                    if (current_color != -1) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        ab_append(ab, buf, clen);
-                    }
-                }
-                else if (hl[j] == HL_NORMAL) {
-                    if (current_color != -1) {
-                        ab_append(ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-                    ab_append(ab, &c[j], 1);
-                } else {
-                    int color = syntax_to_color(hl[j]);
-                    if (color != current_color) {
-                        current_color = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        ab_append(ab, buf, clen);
-                    }
-                    ab_append(ab, &c[j], 1);
+                unsigned char ch = chars[j];
+                if (iscntrl(ch)) {
+                    chars[j] = (ch <= 26) ? '@' + ch : '?';
+                    attrs[j] |= ATTR_INVERSE;
                 }
             }
-            ab_append(ab, "\x1b[39m", 5);
-            //ab_append(ab, &ES.row[filerow].render[ES.coloff], len);
         }
+    }
 
-        ab_append(ab, "\x1b[K", 3); // clear line right of cursor
-        ab_append(ab, "\r\n", 2);
+    for (y = 0; row && y < HL_LOOKAHEAD; y++, row = row_iter_next(&it)) {
+        editor_highlight_row(row, ES.rowoff + ES.screenrows + y);
     }
 }
 
-void draw_statusbar(struct abuf *ab) {
-    ab_append(ab, "\x1b[7m", 4);
-    char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+void draw_statusbar() {
+    int y = ES.screenrows;
+    char status[120], rstatus[80];
+    int len;
+    if (ES.prof.active) { // averages over the frames before this one
+        double* ms = ES.prof.avg_ms;
+        len = snprintf(status, sizeof(status), "key %.2f hl %.2f draw %.2f write %.2f ms | %.0f B %.0f rows",
+                       ms[PROF_KEY], ms[PROF_SYNTAX], ms[PROF_DRAW], ms[PROF_WRITE],
+                       ES.prof.avg_bytes, ES.prof.avg_rows);
+    } else {
+        len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
                                                 ES.filename ? ES.filename : "[NO NAME]",
                                                 ES.numrows,
                                                 ES.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
-                                                   ES.syntax ? ES.syntax->filetype : "no ft",
-                                                   ES.cy + 1, ES.numrows);
-    if (len > ES.screencols) len = ES.screencols;
-    ab_append(ab, status, len);
-    while (len < ES.screencols) {
-        if (ES.screencols - len == rlen) {
-            ab_append(ab, rstatus, rlen);
-            break;
+    }
+    if (len >= (int)sizeof(status)) len = sizeof(status) - 1;
+    char matches[40] = "";
+    if (ES.find.active && ES.find.matches) {
+        if (ES.find.nmatches) {
+            snprintf(matches, sizeof(matches), "match %d of %d | ", ES.find.current + 1, ES.find.nmatches);
         } else {
-            ab_append(ab, " ", 1);
-            len++;
+            snprintf(matches, sizeof(matches), "no matches | ");
         }
     }
-    ab_append(ab, "\x1b[m", 3);
-    ab_append(ab, "\r\n", 2);
+    int rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | %d/%d", matches,
+                                                   ES.syntax ? ES.syntax->filetype : "no ft",
+                                                   ES.cy + 1, ES.numrows);
+    if (len > ES.screencols) len = ES.screencols;
+
+    memset(screen_chars(y), ' ', ES.screencols);
+    memset(screen_attrs(y), ATTR_INVERSE, ES.screencols);
+    screen_put(y, 0, status, len, ATTR_INVERSE);
+    if (len + rlen <= ES.screencols) screen_put(y, ES.screencols - rlen, rstatus, rlen, ATTR_INVERSE);
 }
 
-void draw_messagebar(struct abuf *ab) {
-    ab_append(ab, "\x1b[7m", 4);
-    ab_append(ab, "\x1b[K", 3);
+void draw_messagebar() {
+    int y = ES.screenrows + 1;
+    screen_clear_row(y);
     int msglen = strlen(ES.statusmsg);
     if (msglen > ES.screencols) msglen = ES.screencols;
-    if (msglen && time(NULL) - ES.statusmsg_time < 5) ab_append(ab, ES.statusmsg, msglen);
-    ab_append(ab, "\x1b[m", 3);
+    if (msglen && time(NULL) - ES.statusmsg_time < 5) screen_put(y, 0, ES.statusmsg, msglen, ATTR_INVERSE);
 }
 
 void refresh_screen() {
+    static int shown_rowoff; // the file row at the top of the last frame
+    struct prof_probe p;
+    PROF_END(&ES.prof.key, PROF_KEY, 0);
+    PROF_BEGIN(&p);
     editor_scroll();
 
-    struct abuf ab = ABUF_INT;
-    ab_append(&ab, "\x1b[?25l", 6); // hide cursor
-    ab_append(&ab, "\x1b[H", 3); // reset cursor position
-    draw_rows(&ab);
-    draw_statusbar(&ab);
-    draw_messagebar(&ab);
+    frame_begin(&ES.frame);
+    draw_rows();
+    draw_statusbar();
+    draw_messagebar();
 
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (ES.cy - ES.rowoff) + 1, (ES.rx - ES.coloff) + 1);
-    ab_append(&ab, buf, strlen(buf));
+    screen_flush(&ES.frame, ES.cy - ES.rowoff, ES.rx - ES.coloff, ES.screenrows, ES.rowoff - shown_rowoff);
+    shown_rowoff = ES.rowoff;
+    PROF_END(&p, PROF_DRAW, 0);
 
-    ab_append(&ab, "\x1b[?25h", 6); // show cursor
+    PROF_BEGIN(&p);
+    long long bytes = frame_flush(&ES.frame, STDOUT_FILENO);
+    PROF_END(&p, PROF_WRITE, 0);
+    prof_frame(bytes);
+}
 
-    write(STDOUT_FILENO, ab.b, ab.len);
-    ab_free(&ab);
+// the terminal changed size, lay the screen out for it and draw it again
+void editor_resize() {
+    int rows, cols;
+    if (get_window_size(&rows, &cols) == -1 || rows < 3 || cols < 1) return; // too small to draw on
+    if (rows == ES.screen.rows && cols == ES.screen.cols) return;
+    screen_init(rows, cols);
+    ES.screenrows = rows - 2;
+    ES.screencols = cols;
+    refresh_screen();
 }
 
 void editor_set_statusmessage(const char *fmt, ...) {
@@ -873,7 +4804,7 @@ void editor_set_statusmessage(const char *fmt, ...) {
 }
 
 /* input */
-char* editor_prompt(char* prompt, void (*callback)(char*, int)) {
+char* editor_prompt(char* prompt, void (*callback)(char*, int), int allow_empty) {
     size_t bufsize = 128;
     char* buf = malloc(bufsize);
 
@@ -895,11 +4826,24 @@ char* editor_prompt(char* prompt, void (*callback)(char*, int)) {
             return NULL;
         }
         else if (c == '\r') {
-            if (buflen != 0) {
+            if (buflen != 0 || allow_empty) {
                 editor_set_statusmessage("");
                 if (callback) callback(buf, c);
                 return buf;
             }
+        } else if (c == PASTE_START) {
+            int len, i;
+            char* text = read_paste(&len);
+            for (i = 0; i < len && text[i] != '\n'; i++) {
+                if (iscntrl((unsigned char)text[i]) || (unsigned char)text[i] >= 128) continue;
+                if (buflen == bufsize - 1) {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = text[i];
+            }
+            buf[buflen] = '\0';
+            free(text);
         } else if (!iscntrl(c) && c < 128) {
             if (buflen == bufsize - 1) {
                 bufsize *= 2;
@@ -913,7 +4857,7 @@ char* editor_prompt(char* prompt, void (*callback)(char*, int)) {
 }
 
 void move_cursor(int key) {
-    erow* row = (ES.cy >= ES.numrows) ? NULL : &ES.row[ES.cy];
+    erow* row = editor_row(ES.cy);
 
     switch (key) {
         case ARROW_UP:
@@ -923,7 +4867,7 @@ void move_cursor(int key) {
             if (ES.cx != 0) ES.cx--;
             else if (ES.cy > 0) {
                 ES.cy--;
-                ES.cx = ES.row[ES.cy].size;
+                ES.cx = editor_row(ES.cy)->size;
             }
             break;
         case ARROW_DOWN:
@@ -938,7 +4882,7 @@ void move_cursor(int key) {
             break;
     }
 
-    row = (ES.cy >= ES.numrows) ? NULL : &ES.row[ES.cy];
+    row = editor_row(ES.cy);
     int rowlen = row ? row->size : 0;
     if (ES.cx > rowlen) {
         ES.cx = rowlen;
@@ -950,6 +4894,7 @@ void process_keypress() {
 
     int c = read_key();
 
+    undo_begin();
     switch (c) {
         case '\r':
             editor_insert_newline();
@@ -960,6 +4905,7 @@ void process_keypress() {
                 quit_times--;
                 return;
             }
+            swap_stop();
             clear_screen();
             exit(0);
             break;
@@ -970,11 +4916,14 @@ void process_keypress() {
             ES.cx = 0;
             break;
         case END_KEY:
-            if (ES.cy < ES.numrows) ES.cx = ES.row[ES.cy].size;
+            if (ES.cy < ES.numrows) ES.cx = editor_row(ES.cy)->size;
             break;
         case CTRL_KEY('f'):
             editor_find();
             break;
+        case CTRL_KEY('r'):
+            editor_replace();
+            break;
         case BACKSPACE:
         case CTRL_KEY('h'):
         case DEL_KEY:
@@ -1004,15 +4953,148 @@ void process_keypress() {
             move_cursor(c);
             break;
         case CTRL_KEY('l'):
+            screen_invalidate();
+            break;
+        case PASTE_START:
+            editor_paste();
+            break;
+        case CTRL_KEY('z'):
+            editor_undo();
+            break;
+        case CTRL_KEY('y'):
+            editor_redo();
+            break;
+        case CTRL_KEY('p'):
+            prof_toggle();
+            break;
         case '\x1b':
             break;
         default:
             editor_insert_char(c);
             break;
     }
+    undo_end();
     quit_times = QUIT_TIMES;
 }
 
+/* bench */
+/* inn --bench SCRIPT FILE [ROWSxCOLS] opens FILE on a virtual screen and
+** feeds it SCRIPT, the raw bytes a terminal would send, as if typed. each
+** key is timed from when it is read to when the next one is asked for, so
+** the refresh it causes counts, and frames are counted instead of written.
+** when the script runs out the latencies and frame sizes are reported */
+#define BENCH_ROWS 50
+#define BENCH_COLS 160
+
+double bench_ms(struct timespec* from, struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+void bench_key_read() {
+    clock_gettime(CLOCK_MONOTONIC, &ES.bench.key_read);
+}
+
+void bench_key_done() {
+    struct bench* b = &ES.bench;
+    if (b->key_read.tv_sec == -1) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (b->nkeys == b->capkeys) {
+        b->capkeys = b->capkeys ? b->capkeys * 2 : 1024;
+        b->latency = realloc(b->latency, sizeof(long long) * b->capkeys);
+        if (b->latency == NULL) die("realloc");
+    }
+    b->latency[b->nkeys++] = (now.tv_sec - b->key_read.tv_sec) * 1000000000LL + (now.tv_nsec - b->key_read.tv_nsec);
+    b->key_read.tv_sec = -1;
+}
+
+void bench_frame(long long bytes) {
+    struct bench* b = &ES.bench;
+    if (b->nframes == b->capframes) {
+        b->capframes = b->capframes ? b->capframes * 2 : 1024;
+        b->frame_bytes = realloc(b->frame_bytes, sizeof(long long) * b->capframes);
+        if (b->frame_bytes == NULL) die("realloc");
+    }
+    b->frame_bytes[b->nframes++] = bytes;
+}
+
+int bench_compare(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// the p'th percentile of n sorted values
+long long bench_percentile(long long* v, int n, int p) {
+    return n ? v[(long long)(n - 1) * p / 100] : 0;
+}
+
+void bench_report() {
+    struct bench* b = &ES.bench;
+    long long total = 0, bytes = 0;
+    int j;
+    bench_key_done();
+    for (j = 0; j < b->nkeys; j++) total += b->latency[j];
+    for (j = 0; j < b->nframes; j++) bytes += b->frame_bytes[j];
+    qsort(b->latency, b->nkeys, sizeof(long long), bench_compare);
+    qsort(b->frame_bytes, b->nframes, sizeof(long long), bench_compare);
+
+    printf("%s on %s: %d lines opened in %.1fms, %dx%d screen\n",
+           b->script, ES.filename, b->lines, b->open_ms, b->rows, b->cols);
+    printf("  %d keys in %.1fms, latency p50 %.1fus p99 %.1fus max %.1fus\n",
+           b->nkeys, total / 1e6, bench_percentile(b->latency, b->nkeys, 50) / 1e3,
+           bench_percentile(b->latency, b->nkeys, 99) / 1e3,
+           bench_percentile(b->latency, b->nkeys, 100) / 1e3);
+    printf("  %d frames, %lld bytes, per frame p50 %lld p99 %lld max %lld\n",
+           b->nframes, bytes, bench_percentile(b->frame_bytes, b->nframes, 50),
+           bench_percentile(b->frame_bytes, b->nframes, 99),
+           bench_percentile(b->frame_bytes, b->nframes, 100));
+}
+
+// every key has been replayed, the report is printed on exit
+void bench_finish() {
+    swap_stop();
+    exit(0);
+}
+
+int bench_main(int argc, char* argv[]) {
+    struct bench* b = &ES.bench;
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s --bench SCRIPT FILE [ROWSxCOLS]\n", argv[0]);
+        return 1;
+    }
+    b->active = 1;
+    b->script = argv[2];
+    b->rows = BENCH_ROWS;
+    b->cols = BENCH_COLS;
+    b->key_read.tv_sec = -1;
+    if (argc >= 5 && (sscanf(argv[4], "%dx%d", &b->rows, &b->cols) != 2 || b->rows < 3 || b->cols < 1)) {
+        fprintf(stderr, "%s: bad screen size %s\n", argv[0], argv[4]);
+        return 1;
+    }
+
+    int fd = open(b->script, O_RDONLY);
+    if (fd == -1) die(b->script);
+    size_t len;
+    ES.pending = read_all(fd, &len);
+    ES.npending = len;
+    close(fd);
+
+    init_editor();
+    editor_set_statusmessage("Ctrl-Q to quit");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    editor_open(argv[3]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    b->open_ms = bench_ms(&start, &end);
+    b->lines = ES.numrows;
+    atexit(bench_report); // a script may quit
+
+    while (1) {
+        refresh_screen();
+        process_keypress();
+    }
+}
+
 /* init */
 void init_editor() {
     ES.cx = 0;
@@ -1021,26 +5103,41 @@ void init_editor() {
     ES.rowoff = 0;
     ES.coloff = 0;
     ES.numrows = 0;
-    ES.row = NULL;
+    ES.lines = lt_node_new(1);
+    ES.map = NULL;
+    ES.maplen = 0;
+    ES.hl_gen = 1;
+    ES.hl_frontier = 0;
     ES.dirty = 0;
     ES.filename = NULL;
     ES.statusmsg[0] = '\0';
     ES.statusmsg_time = 0;
     ES.syntax = NULL;
-
-    if (get_window_size(&ES.screenrows, &ES.screencols) == -1) { die("get_window_size"); }
+    ES.lexer = NULL;
+    ES.swap.fd = -1;
+    ES.find.current = -1;
+    ES.events.winch[0] = ES.events.winch[1] = -1; // until events_init
+
+    if (ES.bench.active) {
+        ES.screenrows = ES.bench.rows;
+        ES.screencols = ES.bench.cols;
+    } else if (get_window_size(&ES.screenrows, &ES.screencols) == -1) {
+        die("get_window_size");
+    }
+    screen_init(ES.screenrows, ES.screencols);
     ES.screenrows -= 2;
 }
 
 int main(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) return bench_main(argc, argv);
     enable_raw_mode();
     init_editor();
+    events_init();
+    editor_set_statusmessage("Ctrl-Q to quit");
     if (argc >= 2) {
         editor_open(argv[1]);
     }
 
-    editor_set_statusmessage("Ctrl-Q to quit");
-
     while (1) {
         refresh_screen();
         process_keypress();
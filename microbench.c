@@ -0,0 +1,329 @@
+/* microbench times inn's hot functions on their own over synthetic corpora.
+** it is built from inn.c, with inn's main renamed out of the way, and counts
+** the allocations inn makes through macros over the allocator.
+**
+** usage: microbench [-q] [-o FILE]
+**   -q        corpora a tenth of the size, for a quick look
+**   -o FILE   also write the results as tab separated values, to compare builds
+*/
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+long mb_allocs; // every allocation inn has made, bumped from pool workers too
+
+void* mb_malloc(size_t n) {
+    __sync_fetch_and_add(&mb_allocs, 1);
+    return malloc(n);
+}
+
+void* mb_calloc(size_t n, size_t size) {
+    __sync_fetch_and_add(&mb_allocs, 1);
+    return calloc(n, size);
+}
+
+void* mb_realloc(void* p, size_t n) {
+    __sync_fetch_and_add(&mb_allocs, 1);
+    return realloc(p, n);
+}
+
+char* mb_strdup(const char* s) {
+    __sync_fetch_and_add(&mb_allocs, 1);
+    return strdup(s);
+}
+
+#define malloc(n) mb_malloc(n)
+#define calloc(n, size) mb_calloc(n, size)
+#define realloc(p, n) mb_realloc(p, n)
+#define strdup(s) mb_strdup(s)
+
+#undef _DEFAULT_SOURCE // the headers above defined it, inn.c defines it again
+#define main inn_main
+#include "inn.c"
+#undef main
+
+#define MB_REPS 3 // each measurement is the fastest of this many runs
+
+/* corpora */
+struct corpus {
+    const char* name;
+    void (*write)(FILE* f, long scale);
+    const char* literal; // what find looks for
+    const char* regex;
+    char* path;
+    size_t size;
+};
+
+// tab separated columns, most of every line is tabs to expand
+void corpus_tabs(FILE* f, long scale) {
+    long i;
+    for (i = 0; i < 400000 * scale / 10; i++) {
+        fprintf(f, "%ld\t\tname %ld\t%d\t\t\tx\t%ld.5\t\t\"tab\tin\tstring\"\t\t\n", i, i % 1000, (int)(i % 7), i * 3);
+    }
+}
+
+// one line of 100MB
+void corpus_long(FILE* f, long scale) {
+    long i;
+    for (i = 0; i < 2800000 * scale / 10; i++) {
+        fprintf(f, "{\"k%07ld\": %ld, \"s\": \"a\\tb\"}, ", i, i * 7);
+    }
+    fputc('\n', f);
+}
+
+// comment delimiters in strings. a line starting outside a comment is all
+// strings, one starting inside toggles in and out of it and ends inside,
+// so the state of every line is that of the first
+void corpus_comments(FILE* f, long scale) {
+    long i;
+    for (i = 0; i < 1000000 * scale / 10; i++) {
+        fprintf(f, "s%ld = \"*/ x%ld /*\"; t = \"/* %ld */ /*\";\n", i, i, i);
+    }
+}
+
+// 5M short lines
+void corpus_short(FILE* f, long scale) {
+    long i;
+    for (i = 0; i < 5000000 * scale / 10; i++) {
+        fprintf(f, "x = %ld;\n", i % 100);
+    }
+}
+
+struct corpus CORPORA[] = {
+    { "tabs", corpus_tabs, "name 999", "[0-9]+\\.5", NULL, 0 },
+    { "long", corpus_long, "k2000000", "k[0-9]*99\"", NULL, 0 },
+    { "comments", corpus_comments, "x999999 /*", "s[0-9]*7 =", NULL, 0 },
+    { "short", corpus_short, "= 42;", "[0-9]9;", NULL, 0 },
+};
+
+#define NCORPORA (sizeof(CORPORA) / sizeof(CORPORA[0]))
+
+void corpus_make(struct corpus* c, const char* dir, long scale) {
+    c->path = malloc(strlen(dir) + strlen(c->name) + 4);
+    sprintf(c->path, "%s/%s.c", dir, c->name); // .c so the rows are highlighted
+    FILE* f = fopen(c->path, "w");
+    if (f == NULL) die(c->path);
+    c->write(f, scale);
+    if (fclose(f) == EOF) die(c->path);
+    struct stat st;
+    stat(c->path, &st);
+    c->size = st.st_size;
+}
+
+void mb_free_nodes(struct lt_node* node) {
+    int i;
+    if (!node->leaf) {
+        for (i = 0; i < node->n; i++) mb_free_nodes(node->slot[i]);
+    }
+    free(node);
+}
+
+// undo editor_open, so the next one starts from nothing
+void mb_close() {
+    struct row_iter it;
+    erow* row;
+    erow* slab = NULL; // the rows are still in the order they were loaded
+    for (row = row_iter_seek(&it, 0); row; row = row_iter_next(&it)) {
+        if ((row->flags & ROW_SLAB) && slab == NULL) slab = row;
+        editor_free_row(row);
+        if (!(row->flags & ROW_SLAB)) free(row);
+    }
+    free(slab);
+    mb_free_nodes(ES.lines);
+    ES.lines = lt_node_new(1);
+    ES.numrows = 0;
+    ES.hl_frontier = 0;
+    if (ES.map) munmap(ES.map, ES.maplen);
+    ES.map = NULL;
+    ES.maplen = 0;
+    swap_stop();
+}
+
+/* timing */
+struct mb_result {
+    const char* function;
+    const char* corpus;
+    double bytes; // what one run works through
+    double ops; // calls in one run
+    double ns; // fastest run
+    double allocs; // per run
+};
+
+struct mb_result* RESULTS;
+int NRESULTS;
+
+long long mb_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+void mb_report(struct mb_result* r) {
+    printf("%-20s %-9s %9.1f %9.0f %9.3f %12.1f %9.2f\n", r->function, r->corpus, r->bytes / 1e6, r->ops,
+           r->ns / r->bytes, r->ns / r->ops, r->allocs / r->ops);
+    fflush(stdout);
+}
+
+// time `run`, which calls the function ops times over bytes, keeping the fastest of MB_REPS
+void mb_time(const char* function, struct corpus* c, double bytes, double ops, void (*run)(void*), void* arg) {
+    struct mb_result r = { function, c->name, bytes, ops, 0, 0 };
+    int rep;
+    for (rep = 0; rep < MB_REPS; rep++) {
+        long allocs = mb_allocs;
+        long long start = mb_now();
+        run(arg);
+        double ns = mb_now() - start;
+        if (rep == 0 || ns < r.ns) r.ns = ns;
+        r.allocs = mb_allocs - allocs;
+    }
+    RESULTS = realloc(RESULTS, sizeof(struct mb_result) * (NRESULTS + 1));
+    RESULTS[NRESULTS++] = r;
+    mb_report(&r);
+}
+
+/* benchmarks */
+void run_open(void* arg) {
+    struct corpus* c = arg;
+    mb_close();
+    editor_open(c->path);
+}
+
+// every row from nothing, as after a change of syntax
+void run_highlight_all(void* arg) {
+    (void)arg;
+    struct row_iter it;
+    erow* row;
+    int y = 0;
+    ES.hl_gen++;
+    ES.hl_frontier = 0;
+    for (row = row_iter_seek(&it, 0); row; row = row_iter_next(&it)) editor_highlight_row(row, y++);
+}
+
+void run_update_row(void* arg) {
+    (void)arg;
+    struct row_iter it;
+    erow* row;
+    for (row = row_iter_seek(&it, 0); row; row = row_iter_next(&it)) update_row(row);
+}
+
+void run_update_syntax(void* arg) {
+    (void)arg;
+    struct row_iter it;
+    erow* row;
+    for (row = row_iter_seek(&it, 0); row; row = row_iter_next(&it)) update_syntax(row);
+}
+
+// open or close a comment at the top and lex every row below it again
+void run_catch_up(void* arg) {
+    (void)arg;
+    erow* row = editor_row(0);
+    if (row->size >= 2 && !memcmp(row_chars(row), "/*", 2)) {
+        row_delete_range(row, 0, 2);
+    } else {
+        row_insert_string(row, 0, "/*", 2);
+    }
+    syntax_catch_up(ES.numrows);
+}
+
+void run_cxtorx(void* arg) {
+    (void)arg;
+    struct row_iter it;
+    erow* row;
+    volatile int sink = 0;
+    for (row = row_iter_seek(&it, 0); row; row = row_iter_next(&it)) {
+        sink += editor_row_cxtorx(row, row->size);
+        sink += editor_row_cxtorx(row, row->size / 2);
+        sink += editor_row_cxtorx(row, row->size / 3);
+    }
+}
+
+void run_write_rows(void* arg) {
+    int fd = *(int*)arg;
+    size_t len;
+    lseek(fd, 0, SEEK_SET);
+    if (write_rows(fd, &len) == -1) die("write_rows");
+}
+
+struct find_run_arg {
+    const char* q;
+    int regex;
+};
+
+void run_find(void* arg) {
+    struct find_run_arg* f = arg;
+    int n;
+    free(find_all(f->q, strlen(f->q), f->regex, NULL, &n));
+}
+
+void bench_corpus(struct corpus* c) {
+    double bytes = c->size;
+    mb_time("editor_open", c, bytes, 1, run_open, c);
+
+    double rows = ES.numrows;
+    mb_time("editor_highlight_row", c, bytes, rows, run_highlight_all, NULL);
+    mb_time("update_row", c, bytes, rows, run_update_row, NULL);
+    mb_time("update_syntax", c, bytes, rows, run_update_syntax, NULL);
+    mb_time("syntax_catch_up", c, bytes, rows, run_catch_up, NULL);
+    mb_time("editor_row_cxtorx", c, bytes, rows * 3, run_cxtorx, NULL);
+
+    int fd = open("/dev/null", O_WRONLY);
+    mb_time("write_rows", c, bytes, 1, run_write_rows, &fd);
+    close(fd);
+
+    struct find_run_arg literal = { c->literal, 0 }, regex = { c->regex, 1 };
+    mb_time("find_all", c, bytes, 1, run_find, &literal);
+    mb_time("find_all regex", c, bytes, 1, run_find, &regex);
+    mb_close();
+}
+
+int main(int argc, char* argv[]) {
+    long scale = 10;
+    const char* out = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "qo:")) != -1) {
+        if (opt == 'q') {
+            scale = 1;
+        } else if (opt == 'o') {
+            out = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-q] [-o FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // a virtual screen, as inn --bench runs on
+    ES.bench.active = 1;
+    ES.bench.rows = BENCH_ROWS;
+    ES.bench.cols = BENCH_COLS;
+    init_editor();
+
+    char dir[] = "/tmp/inn-microbench-XXXXXX";
+    if (mkdtemp(dir) == NULL) die("mkdtemp");
+
+    printf("%-20s %-9s %9s %9s %9s %12s %9s\n", "function", "corpus", "MB", "ops", "ns/byte", "ns/op", "allocs/op");
+    unsigned int i;
+    for (i = 0; i < NCORPORA; i++) {
+        corpus_make(&CORPORA[i], dir, scale);
+        bench_corpus(&CORPORA[i]);
+        unlink(CORPORA[i].path);
+    }
+    rmdir(dir);
+
+    if (out) {
+        FILE* f = fopen(out, "w");
+        if (f == NULL) die(out);
+        fprintf(f, "function\tcorpus\tbytes\tops\tns\tns_per_byte\tns_per_op\tallocs_per_op\n");
+        int j;
+        for (j = 0; j < NRESULTS; j++) {
+            struct mb_result* r = &RESULTS[j];
+            fprintf(f, "%s\t%s\t%.0f\t%.0f\t%.0f\t%.4f\t%.1f\t%.3f\n", r->function, r->corpus, r->bytes, r->ops,
+                    r->ns, r->ns / r->bytes, r->ns / r->ops, r->allocs / r->ops);
+        }
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,1082 @@
+/* tests drives inn's editing commands the way process_keypress does and
+** checks the buffer and the cursor after each one. it is built from inn.c,
+** with inn's main renamed out of the way, like microbench.
+**
+** usage: tests
+*/
+
+#define main inn_main
+#include "inn.c"
+#undef main
+
+int FAILURES;
+char DIR[] = "/tmp/inn-tests-XXXXXX";
+
+void write_text(const char* text) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/t.c", DIR);
+    FILE* f = fopen(path, "w");
+    if (f == NULL) die(path);
+    fputs(text, f);
+    fclose(f);
+}
+
+// open a file on a virtual screen
+void open_path(char* path) {
+    init_editor();
+    undo_clear();
+    editor_open(path);
+}
+
+// open a file holding text
+void open_text(const char* text) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/t.c", DIR);
+    write_text(text);
+    open_path(path);
+}
+
+void close_text() {
+    swap_stop();
+    char path[64];
+    snprintf(path, sizeof(path), "%s/t.c", DIR);
+    unlink(path);
+}
+
+// the buffer as it would be saved
+char* buffer_text() {
+    size_t len = 1;
+    struct row_iter it;
+    erow* row;
+    for (row = row_iter_seek(&it, 0); row; row = row_iter_next(&it)) len += row->size + 1;
+    char* text = malloc(len);
+    char* p = text;
+    for (row = row_iter_seek(&it, 0); row; row = row_iter_next(&it)) {
+        memcpy(p, row_chars(row), row->size);
+        p += row->size;
+        *p++ = '\n';
+    }
+    *p = '\0';
+    return text;
+}
+
+void check(const char* test, const char* step, const char* text, int cy, int cx) {
+    char* got = buffer_text();
+    if (strcmp(got, text) || ES.cy != cy || ES.cx != cx) {
+        printf("FAIL %s, %s: want cursor %d,%d and \"%s\", got %d,%d and \"%s\"\n",
+               test, step, cy, cx, text, ES.cy, ES.cx, got);
+        FAILURES++;
+    }
+    free(got);
+}
+
+void command(void (*run)()) {
+    undo_begin();
+    run();
+    undo_end();
+}
+
+/* line tree */
+// the rows the tree should hold, in order, edited alongside it
+char MODEL[8192][8];
+int NMODEL;
+
+void check_rows(const char* test, const char* step) {
+    size_t len = 1;
+    int i;
+    for (i = 0; i < NMODEL; i++) len += strlen(MODEL[i]) + 1;
+    char* want = malloc(len);
+    char* p = want;
+    *p = '\0';
+    for (i = 0; i < NMODEL; i++) p += sprintf(p, "%s\n", MODEL[i]);
+    char* got = buffer_text();
+    int bad = ES.numrows != NMODEL || strcmp(got, want);
+    for (i = 0; !bad && i < NMODEL; i++) {
+        erow* row = editor_row(i);
+        bad = row->size != (int)strlen(MODEL[i]) || memcmp(row_chars(row), MODEL[i], row->size) ||
+              editor_row_index(row) != i;
+    }
+    if (bad) {
+        printf("FAIL %s, %s: %d rows, want %d\n", test, step, ES.numrows, NMODEL);
+        FAILURES++;
+    }
+    free(got);
+    free(want);
+}
+
+void model_insert(int at, int n, int label) {
+    memmove(MODEL[at + n], MODEL[at], sizeof(MODEL[0]) * (NMODEL - at));
+    int i;
+    for (i = 0; i < n; i++) sprintf(MODEL[at + i], "n%d", label + i);
+    NMODEL += n;
+}
+
+void model_delete(int at, int n) {
+    memmove(MODEL[at], MODEL[at + n], sizeof(MODEL[0]) * (NMODEL - at - n));
+    NMODEL -= n;
+}
+
+void insert_rows(int at, int n, int label) {
+    char* text = malloc(n * 8 + 1);
+    char* p = text;
+    int i;
+    for (i = 0; i < n; i++) p += sprintf(p, "n%d\n", label + i);
+    if (n == 1) editor_insert_row(at, text, p - text - 1);
+    else editor_insert_rows(at, text, p - text);
+    model_insert(at, n, label);
+    free(text);
+}
+
+void delete_rows(int at, int n) {
+    if (n == 1) editor_delete_row(at);
+    else editor_delete_rows(at, n);
+    model_delete(at, n);
+}
+
+// single rows and runs of them in and out at the edges of the leaves, until
+// they split and merge, then at random, checking every row after each step
+void test_line_tree() {
+    int nrows = 8 * LT_ORDER;
+    char* text = malloc(nrows * 8 + 1);
+    char* p = text;
+    NMODEL = 0;
+    int i, k;
+    for (i = 0; i < nrows; i++) {
+        sprintf(MODEL[NMODEL++], "r%d", i);
+        p += sprintf(p, "r%d\n", i);
+    }
+    open_text(text);
+    check_rows("line tree", "open");
+
+    int label = 0;
+    char step[64];
+    for (k = 1; k <= 4; k++) {
+        int edges[] = { k * LT_ORDER - 1, k * LT_ORDER, k * LT_ORDER + 1, k * LT_ORDER / 4 * 3 };
+        for (i = 0; i < 4; i++) {
+            insert_rows(edges[i], 1, label++);
+            sprintf(step, "insert row at %d", edges[i]);
+            check_rows("line tree", step);
+        }
+    }
+    for (i = 0; i <= LT_ORDER; i++) insert_rows(LT_ORDER, 1, label++); // splits a leaf
+    check_rows("line tree", "split a leaf");
+    insert_rows(LT_ORDER - 2, 2 * LT_ORDER + 5, label);
+    label += 2 * LT_ORDER + 5;
+    check_rows("line tree", "insert rows across leaves");
+    for (i = 0; i <= LT_ORDER; i++) delete_rows(LT_ORDER, 1); // empties a leaf
+    check_rows("line tree", "merge a leaf");
+    delete_rows(LT_ORDER / 2, 3 * LT_ORDER);
+    check_rows("line tree", "delete rows across leaves");
+    delete_rows(NMODEL - LT_ORDER - 3, LT_ORDER + 3);
+    check_rows("line tree", "delete the last rows");
+
+    srand(1);
+    for (i = 0; i < 400; i++) {
+        int n = rand() % 4 ? 1 : 1 + rand() % (2 * LT_ORDER);
+        if (NMODEL + n < 8192 && (rand() % 2 || NMODEL < n)) {
+            int at = rand() % (NMODEL + 1);
+            insert_rows(at, n, label);
+            label += n;
+            sprintf(step, "random insert of %d at %d", n, at);
+        } else {
+            int at = rand() % (NMODEL - n + 1);
+            delete_rows(at, n);
+            sprintf(step, "random delete of %d at %d", n, at);
+        }
+        check_rows("line tree", step);
+    }
+    delete_rows(0, NMODEL);
+    check_rows("line tree", "delete every row");
+    close_text();
+    free(text);
+}
+
+/* rows */
+// s with its tabs turned to spaces the plain way, a column at a time
+int expand_tabs(const char* s, int n, char* out) {
+    int rx = 0, i;
+    for (i = 0; i < n; i++) {
+        if (s[i] == '\t') {
+            do out[rx++] = ' '; while (rx % TAB_STOP);
+        } else {
+            out[rx++] = s[i];
+        }
+    }
+    return rx;
+}
+
+// a row outside the buffer holding s, rendered and lexed whole from nothing
+erow* fresh_row(const char* s, int n, int in_comment) {
+    erow* row = row_new(s, n);
+    editor_render_row(row);
+    syntax_lex_row(row, in_comment, 1);
+    return row;
+}
+
+void free_fresh_row(erow* row) {
+    editor_free_row(row);
+    free(row);
+}
+
+// the row at y holds s, rendered and highlighted as if it had been built from it
+void check_row(const char* test, const char* step, int y, const char* s, int n) {
+    erow* row = editor_row(y);
+    editor_highlight_row(row, y);
+    erow* prev = editor_row(y - 1);
+    erow* want = fresh_row(s, n, prev ? prev->hl_open_comment : 0);
+    char* render = malloc(n * TAB_STOP + 1);
+    int rsize = expand_tabs(s, n, render);
+    if (row->size != n || memcmp(row_chars(row), s, n) || row->rsize != rsize ||
+        memcmp(row->render, render, rsize) || memcmp(row->hl, want->hl, rsize) ||
+        row->hl_open_comment != want->hl_open_comment) {
+        printf("FAIL %s, %s: want \"%.*s\", got \"%.*s\"\n", test, step, n, s, row->size, row_chars(row));
+        FAILURES++;
+    }
+    free(render);
+    free_fresh_row(want);
+}
+
+// text in and out of a row around its gap, the row starting out mapped from
+// the file, checking its chars, render and hl after each edit
+void test_row_edits() {
+    const char* pieces[] = { "\t", "ab", "/*", "*/", "\"", "42", " if ", "\tint x;", "// c" };
+    char model[4096] = "\tint x = 1; // a\tb";
+    int n = strlen(model);
+    open_text("\tint x = 1; // a\tb\nint y;\n");
+    erow* row = editor_row(0);
+    check_row("row edits", "open", 0, model, n);
+
+    char step[64];
+    srand(1);
+    int i;
+    for (i = 0; i < 500; i++) {
+        int at = rand() % (n + 1);
+        if (n < 2048 && (rand() % 3 || n == 0)) {
+            const char* s = pieces[rand() % 9];
+            int len = strlen(s);
+            row_insert_string(row, at, s, len);
+            memmove(&model[at + len], &model[at], n - at);
+            memcpy(&model[at], s, len);
+            n += len;
+            sprintf(step, "insert \"%s\" at %d", s, at);
+        } else {
+            if (at == n) at--;
+            int len = 1 + rand() % 6;
+            if (len > n - at) len = n - at;
+            row_delete_range(row, at, len);
+            memmove(&model[at], &model[at + len], n - at - len);
+            n -= len;
+            sprintf(step, "delete %d at %d", len, at);
+        }
+        check_row("row edits", step, 0, model, n);
+        check_row("row edits", step, 1, "int y;", 6); // in the comment or out of it with row 0
+    }
+    close_text();
+}
+
+// every column of the row at y converted both ways, against walking its
+// chars from the start a tab at a time
+void check_tabs(const char* test, int y) {
+    erow* row = editor_row(y);
+    const char* s = row_chars(row);
+    int cx, rx = 0;
+    for (cx = 0; cx <= row->size; cx++) {
+        int got = editor_row_cxtorx(row, cx);
+        if (got != rx) {
+            printf("FAIL %s: row %d cx %d to rx %d, want %d\n", test, y, cx, got, rx);
+            FAILURES++;
+            return;
+        }
+        if (cx < row->size && s[cx] == '\t') rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+        rx++;
+    }
+    int want, end = rx + TAB_STOP;
+    for (rx = 0; rx < end; rx++) {
+        int cur = 0;
+        for (want = 0; want < row->size; want++) {
+            if (s[want] == '\t') cur += (TAB_STOP - 1) - (cur % TAB_STOP);
+            if (++cur > rx) break;
+        }
+        int got = editor_row_rxtocx(row, rx);
+        if (got != want) {
+            printf("FAIL %s: row %d rx %d to cx %d, want %d\n", test, y, rx, got, want);
+            FAILURES++;
+            return;
+        }
+    }
+}
+
+// rows of tabs and chars at random, as opened and then edited at random
+// places, so their tab index is built whole and rebuilt from a column
+void test_tab_index() {
+    int nrows = 200;
+    char* text = malloc(nrows * 64);
+    char* p = text;
+    srand(1);
+    int y, i;
+    for (y = 0; y < nrows; y++) {
+        int n = rand() % 60;
+        for (i = 0; i < n; i++) *p++ = "\t\tab c"[rand() % 6];
+        *p++ = '\n';
+    }
+    *p = '\0';
+    open_text(text);
+    for (y = 0; y < nrows; y++) check_tabs("tab index", y);
+
+    const char* pieces[] = { "\t", "x", "\tx\t", "abcdefg" };
+    for (i = 0; i < 2000; i++) {
+        y = rand() % nrows;
+        erow* row = editor_row(y);
+        int at = rand() % (row->size + 1);
+        if (rand() % 2) {
+            const char* s = pieces[rand() % 4];
+            row_insert_string(row, at, s, strlen(s));
+        } else {
+            row_delete_range(row, at, 1 + rand() % 3);
+        }
+        check_tabs("tab index", y);
+    }
+    close_text();
+    free(text);
+}
+
+/* highlighting */
+// highlight the rows in ys in that order, as drawing and jumping around
+// would, each compared with the rows above it lexed fresh from the top
+void check_highlight(const char* test, const char* step, const int* ys, int nys) {
+    unsigned char** want = malloc(sizeof(unsigned char*) * ES.numrows);
+    int in_comment = 0;
+    int y, i;
+    for (y = 0; y < ES.numrows; y++) {
+        erow* row = editor_row(y);
+        erow* fresh = fresh_row(row_chars(row), row->size, in_comment);
+        want[y] = malloc(fresh->rsize + 1);
+        memcpy(want[y], fresh->hl, fresh->rsize);
+        in_comment = fresh->hl_open_comment;
+        free_fresh_row(fresh);
+    }
+    for (i = 0; i < nys; i++) {
+        erow* row = editor_row(ys[i]);
+        editor_highlight_row(row, ys[i]);
+        if (memcmp(row->hl, want[ys[i]], row->rsize)) {
+            printf("FAIL %s, %s: row %d is \"%s\"\n", test, step, ys[i], row->render);
+            FAILURES++;
+        }
+    }
+    for (y = 0; y < ES.numrows; y++) free(want[y]);
+    free(want);
+}
+
+void type_comment_open() {
+    editor_insert_text("/*", 2);
+}
+
+void type_comment_close() {
+    editor_insert_text("*/", 2);
+}
+
+// a comment opened on screen runs on past it to a close far below, then is
+// closed again, with rows on screen, below it and jumped to checked each time
+void test_comment_open() {
+    const char* lines[] = { "int a = 1; // note", "\tif (x) return \"s\";", "char* p = \"/* no\";",
+                            "x = y / 2 * 3;", "for (;;) { y = 0x1f; }" };
+    int nrows = 600;
+    char* text = malloc(nrows * 32);
+    char* p = text;
+    int y;
+    for (y = 0; y < nrows; y++) {
+        p += sprintf(p, "%s\n", y == 400 ? "done(); */ z = 2;" : lines[y % 5]);
+    }
+    open_text(text);
+    int screen[BENCH_ROWS];
+    for (y = 0; y < ES.screenrows; y++) screen[y] = y;
+    int jumps[] = { 399, 400, 401, 599, 100, 5, 7 };
+    check_highlight("comment open", "open, on screen", screen, ES.screenrows);
+    check_highlight("comment open", "open, jumped to", jumps, 7); // every row lexed once
+
+    ES.cy = 6;
+    ES.cx = 0;
+    command(type_comment_open);
+    check_highlight("comment open", "open a comment, on screen", screen, ES.screenrows);
+    check_highlight("comment open", "open a comment, jumped to", jumps, 7);
+
+    ES.cy = 8;
+    ES.cx = 0;
+    command(type_comment_close);
+    check_highlight("comment open", "close it, on screen", screen, ES.screenrows);
+    check_highlight("comment open", "close it, jumped to", jumps, 7);
+
+    command(editor_undo);
+    command(editor_undo);
+    check_highlight("comment open", "undo both, jumped to", jumps, 7);
+    check_highlight("comment open", "undo both, on screen", screen, ES.screenrows);
+    close_text();
+    free(text);
+}
+
+// hl spelled a letter a column: . normal, c comment, m multiline comment,
+// k and t the two kinds of keyword, s string, d number
+void check_hl(const char* test, const char* render, const unsigned char* hl, const char* want) {
+    const char* letters = ".cmktsd";
+    int i;
+    for (i = 0; want[i]; i++) {
+        if (letters[hl[i]] != want[i]) {
+            printf("FAIL %s: \"%s\" at column %d, want %s\n", test, render, i, want);
+            FAILURES++;
+            return;
+        }
+    }
+}
+
+void test_highlight_table() {
+    const char* rows[][2] = {
+        { "int main(void) { return 42; }", "ttt......tttt....kkkkkk.dd..." },
+        { "x1 = \"a\\\"b\" + 'c'; // if", ".....ssssss...sss..ccccc" },
+        { "/* if */ int_x; intx y2 3d", "mmmmmmmm................d." },
+        { "switch(c){ case 1.5: break;} /* open", "kkkkkk.....kkkk.ddd..kkkkk...mmmmmmm" },
+        { "still */ 7", "mmmmmmmm.d" },
+        { "returned unsigned\tx;", ".........tttttttt........." },
+    };
+    int nrows = sizeof(rows) / sizeof(rows[0]);
+    char text[512];
+    char* p = text;
+    int y;
+    for (y = 0; y < nrows; y++) p += sprintf(p, "%s\n", rows[y][0]);
+    open_text(text);
+    for (y = 0; y < nrows; y++) {
+        erow* row = editor_row(y);
+        editor_highlight_row(row, y);
+        check_hl("highlight table", row->render, row->hl, rows[y][1]);
+    }
+
+    // every keyword, found in the table whatever its length or kind
+    char** kw;
+    for (kw = ES.syntax->keywords; *kw; kw++) {
+        int len = strlen(*kw);
+        int type2 = (*kw)[len - 1] == '|';
+        if (type2) len--;
+        char s[32], want[32];
+        sprintf(s, "%.*s;", len, *kw);
+        memset(want, type2 ? 't' : 'k', len);
+        strcpy(&want[len], ".");
+        erow* row = fresh_row(s, len + 1, 0);
+        check_hl("highlight table", row->render, row->hl, want);
+        free_fresh_row(row);
+    }
+    close_text();
+}
+
+/* long rows */
+// windows of the long row at y, drawn at each of rxs in turn and then at
+// steps along the whole row, against its render and hl built whole from the
+// start of the row
+void check_windows(const char* test, const char* step, int y, const int* rxs, int nrxs) {
+    erow* row = editor_row(y);
+    editor_highlight_row(row, y);
+    const char* s = row_chars(row);
+    char* render = malloc((size_t)row->size * TAB_STOP);
+    int rlen = expand_tabs(s, row->size, render);
+    unsigned char* hl = malloc(rlen);
+    struct hl_state st = { 0, 0, row->hl_start, 0, 1, HL_NORMAL };
+    int in_comment = syntax_lex(row, render, hl, rlen, 0, 0, st, LONG_LINE_CHECKPOINT, -1); // saving no states
+    if (!(row->flags & ROW_LONG) || row->hl_open_comment != in_comment) {
+        printf("FAIL %s, %s: row %d isn't long or ends out of its comment state\n", test, step, y);
+        FAILURES++;
+    }
+
+    int i;
+    for (i = 0; i < nrxs + rlen / 8191 + 1; i++) {
+        int rx = (i < nrxs) ? rxs[i] : (i - nrxs) * 8191;
+        if (rx >= rlen) rx = rlen - 1;
+        int len = ES.screencols < rlen - rx ? ES.screencols : rlen - rx;
+        row_window(row, rx, ES.screencols);
+        if (rx < row->rstart || rx + len > row->rstart + row->rsize ||
+            memcmp(&row->render[rx - row->rstart], &render[rx], len) ||
+            memcmp(&row->hl[rx - row->rstart], &hl[rx], len)) {
+            printf("FAIL %s, %s: window at %d of %d\n", test, step, rx, rlen);
+            FAILURES++;
+        }
+    }
+    free(render);
+    free(hl);
+}
+
+// a row well past LONG_LINE of tabs, strings and comments, some of them
+// running on for several checkpoints, in a comment opened on the row above
+void test_long_row() {
+    int npieces = 36000;
+    char* text = malloc(npieces * 48 + 64);
+    char* p = text;
+    p += sprintf(p, "/* open\n");
+    int i;
+    for (i = 0; i < npieces; i++) {
+        if (i % 2000 == 0) p += sprintf(p, "/* long ");
+        if (i % 2000 == 1000) p += sprintf(p, "*/ ");
+        p += sprintf(p, "x%d = \"s\\\"t\";\t%sif (y) %d; ", i, i % 2000 > 1000 ? "/* c */ " : "", i * 7);
+    }
+    p += sprintf(p, "// tail\nint z;\n");
+    open_text(text);
+    erow* row = editor_row(1);
+    int rlen = editor_row_cxtorx(row, row->size);
+    int rxs[] = { 0, 100, 40000, rlen / 2, rlen - 50, 5000, rlen, 300000, 3 * LONG_LINE_CHECKPOINT - 7, 70 };
+    int nrxs = sizeof(rxs) / sizeof(rxs[0]);
+    check_windows("long row", "open", 1, rxs, nrxs);
+
+    row_insert_string(row, strstr(row_chars(row), "x24100 = ") - row_chars(row), "*/", 2);
+    check_windows("long row", "close a long comment early", 1, rxs, nrxs);
+    row_insert_string(row, strstr(row_chars(row), "x13500 = ") - row_chars(row), "/*", 2);
+    check_windows("long row", "open a comment", 1, rxs, nrxs);
+    row_insert_string(row, row->size / 2, "\t\"", 2);
+    check_windows("long row", "open a string", 1, rxs, nrxs);
+    row_delete_range(row, 30, 25000);
+    check_windows("long row", "delete across checkpoints", 1, rxs, nrxs);
+    row_delete_range(row, 0, 2); // the comments opening both rows
+    row_delete_range(editor_row(0), 0, 2);
+    check_windows("long row", "no comment above", 1, rxs, nrxs);
+    close_text();
+    free(text);
+}
+
+/* undo */
+void test_undo_join() {
+    const char* text = "abc def\n\tghi abc\n\nxyz\n";
+    const char* joined = "abc def\n\tghi abc\nxyz\n";
+    open_text(text);
+    ES.cy = 2;
+    ES.cx = 0;
+    command(editor_delete_char);
+    check("undo join", "backspace", joined, 1, 8);
+    command(editor_undo);
+    check("undo join", "undo", text, 2, 0);
+    command(editor_redo);
+    check("undo join", "redo", joined, 1, 8);
+    command(editor_undo);
+    command(editor_insert_newline);
+    check("undo join", "enter after undo", "abc def\n\tghi abc\n\n\nxyz\n", 3, 0);
+    close_text();
+}
+
+void test_undo_split() {
+    const char* text = "abc def\n\tghi abc\n";
+    const char* split = "abc\n def\n\tghi abc\n";
+    open_text(text);
+    ES.cy = 0;
+    ES.cx = 3;
+    command(editor_insert_newline);
+    check("undo split", "enter", split, 1, 0);
+    command(editor_undo);
+    check("undo split", "undo", text, 0, 3);
+    command(editor_redo);
+    check("undo split", "redo", split, 1, 0);
+    command(editor_undo);
+    check("undo split", "undo again", text, 0, 3);
+    close_text();
+}
+
+/* paste */
+void paste_xyz() {
+    editor_insert_text("X\nY\nZ", 5);
+}
+
+void paste_newline_q() {
+    editor_insert_text("\nQ", 2);
+}
+
+void test_paste_lines() {
+    const char* text = "abc\ndef\n";
+    const char* pasted = "aX\nY\nZbc\ndef\n";
+    open_text(text);
+    ES.cy = 0;
+    ES.cx = 1;
+    command(paste_xyz);
+    check("paste lines", "paste", pasted, 2, 1);
+    command(editor_undo);
+    check("paste lines", "undo", text, 0, 1);
+    command(editor_redo);
+    check("paste lines", "redo", pasted, 2, 1);
+    close_text();
+}
+
+void test_paste_leading_newline() {
+    const char* text = "abc\ndef\n";
+    const char* pasted = "abc\nQ\ndef\n";
+    open_text(text);
+    ES.cy = 0;
+    ES.cx = 3;
+    command(paste_newline_q);
+    check("paste leading newline", "paste", pasted, 1, 1);
+    if (ES.undo.nrecs != 1) {
+        printf("FAIL paste leading newline: want 1 undo record, got %d\n", ES.undo.nrecs);
+        FAILURES++;
+    }
+    command(editor_undo);
+    check("paste leading newline", "undo", text, 0, 3);
+    command(editor_redo);
+    check("paste leading newline", "redo", pasted, 1, 1);
+    close_text();
+}
+
+/* save */
+char* file_text(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return strdup("");
+    static char text[256];
+    size_t n = fread(text, 1, sizeof(text) - 1, f);
+    text[n] = '\0';
+    fclose(f);
+    return strdup(text);
+}
+
+void check_file(const char* test, const char* path, const char* text) {
+    char* got = file_text(path);
+    if (strcmp(got, text)) {
+        printf("FAIL %s: want %s to hold \"%s\", got \"%s\"\n", test, path, text, got);
+        FAILURES++;
+    }
+    free(got);
+}
+
+void type_x() {
+    editor_insert_char('x');
+}
+
+// saving through a symlink writes its target and leaves the link be
+void test_save_symlink() {
+    char path[64], link[64];
+    snprintf(path, sizeof(path), "%s/t.c", DIR);
+    snprintf(link, sizeof(link), "%s/link.c", DIR);
+    write_text("abc\n");
+    if (symlink("t.c", link) == -1) die("symlink");
+    open_path(link);
+    command(type_x);
+    editor_save();
+    struct stat st;
+    if (lstat(link, &st) == -1 || !S_ISLNK(st.st_mode)) {
+        printf("FAIL save symlink: %s isn't a symlink any more\n", link);
+        FAILURES++;
+    }
+    check_file("save symlink", path, "xabc\n");
+    close_text();
+    unlink(link);
+}
+
+// saving a file with another hard link keeps the inode both names share
+void test_save_hard_link() {
+    char path[64], other[64];
+    snprintf(path, sizeof(path), "%s/t.c", DIR);
+    snprintf(other, sizeof(other), "%s/other.c", DIR);
+    write_text("abc\ndef\n");
+    if (link(path, other) == -1) die("link");
+    open_path(path);
+    ES.cy = 1;
+    command(type_x);
+    editor_save();
+    check_file("save hard link", other, "abc\nxdef\n");
+    close_text();
+    unlink(other);
+}
+
+/* find */
+void check_matches(const char* test, const struct find_match* got, int ngot, const struct find_match* want, int nwant) {
+    int i;
+    for (i = 0; i < ngot && i < nwant; i++) {
+        if (got[i].y != want[i].y || got[i].x != want[i].x || got[i].len != want[i].len) break;
+    }
+    if (i < ngot || i < nwant) {
+        printf("FAIL %s: match %d of %d, want %d of them", test, i, ngot, nwant);
+        if (i < nwant) printf(", at %d,%d len %d", want[i].y, want[i].x, want[i].len);
+        if (i < ngot) printf(", got %d,%d len %d", got[i].y, got[i].x, got[i].len);
+        printf("\n");
+        FAILURES++;
+    }
+}
+
+void check_find(const char* test, const char* q, int regex, const struct find_match* want, int nwant) {
+    int n;
+    struct find_match* got = find_all(q, strlen(q), regex, NULL, &n);
+    check_matches(test, got, n, want, nwant);
+    free(got);
+}
+
+// every search variant the cpu has, with the needle at each place around
+// the 16 and 32 byte blocks and the haystack ending at each length past it
+void test_search_block_edges() {
+    search_fn fns[3] = { search_scalar, NULL, NULL };
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) fns[1] = search_sse2;
+    if (__builtin_cpu_supports("avx2")) fns[2] = search_avx2;
+#endif
+    const char* needles[] = { "ne", "needle", "a needle spanning blocks" };
+    char hay[128];
+    int f, k, at, tail;
+    for (f = 0; f < 3; f++) {
+        if (fns[f] == NULL) continue;
+        for (k = 0; k < 3; k++) {
+            int m = strlen(needles[k]);
+            for (at = 0; at + m <= 80; at++) {
+                for (tail = 0; tail < 3; tail++) {
+                    int n = at + m + tail;
+                    memset(hay, '.', n);
+                    memcpy(hay + at, needles[k], m);
+                    const char* hit = fns[f](hay, n, needles[k], m);
+                    const char* miss = fns[f](hay, at + m - 1, needles[k], m); // cut off before its last byte
+                    if (hit != hay + at || miss != NULL) {
+                        printf("FAIL search block edges: variant %d, \"%s\" at %d of %d\n", f, needles[k], at, n);
+                        FAILURES++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void type_needle() {
+    editor_insert_text("needle", 6);
+}
+
+void test_find_literal() {
+    // across the 16 byte edge and the 32 byte one, in mapped rows that are
+    // scanned as one block, and in a row edited out of the mapping
+    open_text(".............needle.........needle...\n"
+              "needle needle\n"
+              "no match here\n"
+              "needleneedle\n"
+              "aaaaa\n");
+    struct find_match want[] = { { 0, 13, 6 }, { 0, 28, 6 }, { 1, 0, 6 }, { 1, 7, 6 }, { 3, 0, 6 }, { 3, 6, 6 } };
+    check_find("find literal", "needle", 0, want, 6);
+
+    ES.cy = 2;
+    ES.cx = 3;
+    command(type_needle);
+    struct find_match edited[] = { { 0, 13, 6 }, { 0, 28, 6 }, { 1, 0, 6 }, { 1, 7, 6 }, { 2, 3, 6 }, { 3, 0, 6 }, { 3, 6, 6 } };
+    check_find("find literal", "needle", 0, edited, 7);
+
+    struct find_match apart[] = { { 4, 0, 2 }, { 4, 2, 2 } }; // matches don't overlap
+    check_find("find literal", "aa", 0, apart, 2);
+    check_find("find literal", "needles", 0, NULL, 0);
+    close_text();
+}
+
+// enough rows to split into chunks across the pool, with matches in the
+// first and last rows and on both sides of every chunk edge
+void test_find_parallel() {
+    int nrows = 10 * FIND_MIN_CHUNK;
+    char* text = malloc(nrows * 32);
+    char* p = text;
+    struct find_match* want = malloc(sizeof(struct find_match) * nrows * 2);
+    int n = 0;
+    int y;
+    for (y = 0; y < nrows; y++) {
+        if (y % 7 == 0 || y == nrows - 1) {
+            p += sprintf(p, "%d hit%s\n", y, y % 3 ? "" : " hit");
+        } else {
+            p += sprintf(p, "%d miss\n", y);
+        }
+    }
+    *p = '\0';
+
+    // where the hits are, worked out from the digits before them
+    for (y = 0; y < nrows; y++) {
+        if (y % 7 && y != nrows - 1) continue;
+        int digits = snprintf(NULL, 0, "%d", y);
+        want[n++] = (struct find_match){ y, digits + 1, 3 };
+        if (y % 3 == 0) want[n++] = (struct find_match){ y, digits + 5, 3 };
+    }
+
+    open_text(text);
+    check_find("find parallel", "hit", 0, want, n);
+    check_find("find parallel", "h[i]t", 1, want, n);
+
+    // stepping through the index finds each match after a place
+    find_forget();
+    find_update("hit", 3, 0);
+    int i;
+    for (i = 0; i < n; i += 997) {
+        int at = find_match_after(want[i].y, want[i].x);
+        int after = find_match_after(want[i].y, want[i].x + 1);
+        if (at != i || after != i + 1) {
+            printf("FAIL find parallel: match after %d,%d is %d then %d, want %d then %d\n",
+                   want[i].y, want[i].x, at, after, i, i + 1);
+            FAILURES++;
+        }
+    }
+    find_forget();
+    close_text();
+    free(text);
+    free(want);
+}
+
+// type query one character at a time and then take them off again,
+// comparing the prompt's matches with a fresh find_all at every length
+void narrow(const char* test, const char* query, int regex) {
+    char q[64];
+    int len = strlen(query);
+    int step, n;
+    for (step = 1; step < 2 * len; step++) {
+        int qlen = step <= len ? step : 2 * len - step;
+        memcpy(q, query, qlen);
+        q[qlen] = '\0';
+        find_update(q, qlen, regex);
+        struct find_match* want = find_all(q, qlen, regex, NULL, &n);
+        check_matches(test, ES.find.matches, ES.find.nmatches, want, n);
+        free(want);
+    }
+}
+
+void test_find_narrowing() {
+    open_text("needle in a haystack\n"
+              "needless needles\n"
+              "aaaa aaaaaaa a\n"
+              "nee nee nee\n"
+              "the end\n");
+    find_forget();
+    narrow("find narrowing", "needles", 0);
+    find_forget();
+    narrow("find narrowing overlapping", "aaaaa", 0); // its shorter matches aren't every place it can start
+    find_forget();
+    narrow("find narrowing regex", "ne+dl", 1);
+    find_forget();
+    close_text();
+}
+
+/* replace */
+int REPLACED;
+
+void replace_foo() {
+    int rows;
+    REPLACED = replace_all("foo", 3, 0, "quux", 4, &rows);
+}
+
+void replace_digits() {
+    int rows;
+    REPLACED = replace_all("[0-9]+", 6, 1, "N", 1, &rows);
+}
+
+void test_replace_all() {
+    const char* text = "foo = foo(1) + 22\nbar\nfoofoo 333\n";
+    const char* words = "quux = quux(1) + 22\nbar\nquuxquux 333\n";
+    const char* digits = "quux = quux(N) + N\nbar\nquuxquux N\n";
+    open_text(text);
+    ES.cy = 2;
+    ES.cx = 9;
+    command(replace_foo);
+    check("replace all", "replace", words, 2, 9);
+    if (REPLACED != 4) {
+        printf("FAIL replace all: want 4 replaced, got %d\n", REPLACED);
+        FAILURES++;
+    }
+    command(replace_digits);
+    check("replace all", "replace regex", digits, 2, 9);
+    command(editor_undo);
+    check("replace all", "undo regex", words, 2, 9);
+    command(editor_undo);
+    check("replace all", "undo", text, 2, 9);
+    command(editor_redo);
+    check("replace all", "redo", words, 2, 9);
+    command(editor_redo);
+    check("replace all", "redo regex", digits, 2, 9);
+    close_text();
+}
+
+/* swap */
+// die the way a killed inn would, its records written but the swap kept
+void crash() {
+    swap_flush();
+    close(ES.swap.fd);
+    ES.swap.fd = -1;
+}
+
+// open the file again, answering the offer to recover with key
+void reopen(char key) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/t.c", DIR);
+    free(ES.pending);
+    ES.pending = malloc(1);
+    ES.pending[0] = key;
+    ES.npending = 1;
+    ES.pendingpos = 0;
+    open_path(path);
+}
+
+void type_truncated() {
+    editor_insert_text("truncated", 9);
+}
+
+void test_swap_recover() {
+    open_text("abc foo\ndef\nfoo ghi\n");
+    ES.cy = 0;
+    ES.cx = 3;
+    command(type_needle);
+    ES.cy = 1;
+    ES.cx = 0;
+    command(paste_xyz);
+    ES.cy = 3;
+    ES.cx = 0;
+    command(editor_delete_char);
+    command(replace_foo);
+    command(editor_undo);
+    command(editor_redo);
+    char* edited = buffer_text();
+    crash();
+    reopen('y');
+    check("swap recover", "recover", edited, 0, 0);
+
+    // journaling carries on after the records recovered. the last record
+    // here is cut short, as a crash partway through writing it would
+    ES.cy = 0;
+    ES.cx = 0;
+    command(type_comment_open);
+    char* typed = buffer_text();
+    command(type_truncated);
+    crash();
+    struct stat st;
+    if (stat(ES.swap.name, &st) == -1 || truncate(ES.swap.name, st.st_size - 3) == -1) die("truncate");
+    reopen('y');
+    check("swap recover", "recover a truncated record", typed, 0, 0);
+
+    // the swap is cut back to the records that applied, so ones written
+    // after the torn one are recovered too
+    ES.cy = 1;
+    ES.cx = 0;
+    command(type_needle);
+    char* after = buffer_text();
+    crash();
+    reopen('y');
+    check("swap recover", "recover after a truncated record", after, 0, 0);
+
+    reopen('n');
+    check("swap recover", "decline", "abc foo\ndef\nfoo ghi\n", 0, 0);
+    close_text();
+    free(edited);
+    free(typed);
+    free(after);
+}
+
+/* regex */
+// the leftmost, then longest, match from `from` the slow way: the longest
+// anchored match at each place in turn
+int regex_search_slow(struct regex* re, const char* s, int n, int from, int* len) {
+    int st;
+    for (st = from; st <= n; st++) {
+        if ((*len = regex_match_at(re, s, n, st)) != -1) return st;
+    }
+    return -1;
+}
+
+void test_regex_random() {
+    const char* atoms[] = { "a", "b", "c", ".", "[ab]", "^", "$", "\\w", "[^a]" };
+    const char* repeats = "*+?";
+    srand(1);
+    int i, j;
+    for (i = 0; i < 5000; i++) {
+        char pattern[64];
+        int len = 0;
+        int natoms = 1 + rand() % 5;
+        for (j = 0; j < natoms; j++) {
+            if (rand() % 10 == 0) {
+                len += sprintf(pattern + len, "(%s|%s)", atoms[rand() % 9], atoms[rand() % 3]);
+            } else {
+                len += sprintf(pattern + len, "%s", atoms[rand() % 9]);
+            }
+            if (rand() % 2) pattern[len++] = repeats[rand() % 3];
+        }
+        if (rand() % 8 == 0) len += sprintf(pattern + len, "|%s", atoms[rand() % 9]);
+        pattern[len] = '\0';
+        struct regex* re = regex_compile(pattern, len);
+        struct regex* slow = regex_compile(pattern, len);
+        if (re == NULL) continue;
+
+        char s[32];
+        int n = rand() % 24;
+        for (j = 0; j < n; j++) s[j] = "abc "[rand() % 4];
+        int x = 0, st, mlen, want, wantlen;
+        while (x <= n && (st = regex_search_from(re, s, n, x, &mlen)) != -1) {
+            want = regex_search_slow(slow, s, n, x, &wantlen);
+            if (st != want || mlen != wantlen) break;
+            x = st + (mlen ? mlen : 1);
+        }
+        if (x <= n && (st != -1 || regex_search_slow(slow, s, n, x, &wantlen) != -1)) {
+            printf("FAIL regex random: /%s/ on \"%.*s\" from %d\n", pattern, n, s, x);
+            FAILURES++;
+        }
+        regex_free(re);
+        regex_free(slow);
+    }
+}
+
+void test_find_regex() {
+    open_text("ERROR a timeout=30 b timeout=7\n"
+              "INFO timeout=\n"
+              "ERROR c\n"
+              "x ERROR timeout=5\n");
+    struct find_match timeouts[] = { { 0, 0, 30 }, { 3, 2, 15 } };
+    check_find("find regex", "ERROR.*timeout=[0-9]+", 1, timeouts, 2);
+    struct find_match numbers[] = { { 0, 16, 2 }, { 0, 29, 1 }, { 3, 16, 1 } };
+    check_find("find regex", "\\d+", 1, numbers, 3);
+    struct find_match starts[] = { { 0, 0, 5 }, { 2, 0, 5 } };
+    check_find("find regex", "^ERROR", 1, starts, 2);
+    struct find_match ends[] = { { 0, 21, 9 }, { 1, 5, 8 }, { 3, 8, 9 } };
+    check_find("find regex", "t[a-z]+=\\d?$", 1, ends, 3);
+    struct find_match words[] = { { 0, 6, 2 }, { 0, 19, 2 }, { 2, 6, 1 }, { 3, 0, 2 } };
+    check_find("find regex", "(a|b|x) |[abc]$", 1, words, 4);
+    close_text();
+}
+
+// a pattern whose runs outlive its matches, every 'a' matches alone but
+// each start could go on to an 'x' at the end of the row
+void test_regex_linear() {
+    int n = 200000;
+    char* s = malloc(n);
+    memset(s, 'a', n);
+    struct regex* re = regex_compile("a|a.*x", 6);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int x = 0, st, len, matches = 0;
+    while (x <= n && (st = regex_search_from(re, s, n, x, &len)) != -1) {
+        if (st != x || len != 1) break;
+        x = st + len;
+        matches++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    if (matches != n || ms > 2000) {
+        printf("FAIL regex linear: %d of %d matches in %.0fms\n", matches, n, ms);
+        FAILURES++;
+    }
+    regex_free(re);
+    free(s);
+}
+
+int main() {
+    if (mkdtemp(DIR) == NULL) die("mkdtemp");
+    ES.bench.active = 1; // a virtual screen, as inn --bench runs on
+    ES.bench.rows = BENCH_ROWS;
+    ES.bench.cols = BENCH_COLS;
+
+    test_line_tree();
+    test_row_edits();
+    test_tab_index();
+    test_comment_open();
+    test_highlight_table();
+    test_long_row();
+    test_undo_join();
+    test_undo_split();
+    test_paste_lines();
+    test_paste_leading_newline();
+    test_save_symlink();
+    test_save_hard_link();
+    test_search_block_edges();
+    test_find_literal();
+    test_find_parallel();
+    test_find_narrowing();
+    test_find_regex();
+    test_replace_all();
+    test_swap_recover();
+    test_regex_random();
+    test_regex_linear();
+
+    rmdir(DIR);
+    printf("%s\n", FAILURES ? "FAILED" : "ok");
+    return FAILURES != 0;
+}